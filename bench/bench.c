@@ -0,0 +1,486 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#if !defined(_GNU_SOURCE) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+
+/**
+ * Maximum number of latency samples for each operation
+ */
+#define BENCH_SAMPLES 65536
+
+/**
+ * Default table sizes, override them with --sizes
+ */
+#define BENCH_SIZES "1000,10000,100000,1000000"
+
+typedef enum {
+  BENCH_KEYS_SHORT, ///< Short ASCII keys
+  BENCH_KEYS_UTF8, ///< Lines of the UTF-8 corpora in tests/
+  BENCH_KEYS_BINARY ///< 16 random bytes, with NULL bytes
+} BenchKeyKind;
+
+static const char *BenchKeyKind_names[] = {"short", "utf8", "binary"};
+
+typedef enum {
+  BENCH_CHAINED,
+  BENCH_OPEN,
+  BENCH_ARENA ///< Chained table with the arena option
+} BenchEngine;
+
+static const char *BenchEngine_names[] = {"chained", "open", "arena"};
+
+/**
+ * A set of keys, the first half is inserted and the second half
+ * is used for the lookups that miss
+ */
+typedef struct {
+  char *data; ///< All the keys, one after the other
+  size_t *offsets; ///< Position of each key in data
+  size_t *lengths; ///< Length of each key
+  size_t count; ///< Number of keys
+} BenchKeys;
+
+/**
+ * Lines of the UTF-8 corpora
+ */
+typedef struct {
+  char **lines;
+  size_t count;
+} BenchCorpus;
+
+typedef struct {
+  bool json; ///< Print JSON instead of CSV
+  bool first; ///< No result was printed yet
+  size_t sizes[32]; ///< Table sizes
+  size_t sizeCount; ///< Number of table sizes
+  bool keys[3]; ///< Key kinds to run
+  bool engines[3]; ///< Engines to run
+  const char *corpus; ///< Directory of the UTF-8 corpora
+} BenchConfig;
+
+typedef struct {
+  uint64_t *samples; ///< Latency of the sampled operations, in ns
+  size_t count; ///< Number of samples
+  size_t every; ///< One operation every this many is sampled
+} BenchLatency;
+
+static uint64_t Bench_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t Bench_random(uint64_t *state) {
+  // xorshift64*
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dull;
+}
+
+static int Bench_compare(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Reads the lines of a corpus file, without the byte order mark
+ */
+static bool BenchCorpus_load(BenchCorpus *this, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return false;
+  char buffer[1024];
+  while (fgets(buffer, sizeof(buffer), file) != NULL) {
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+    const char *line = (strncmp(buffer, "\xEF\xBB\xBF", 3) == 0) ? buffer + 3 : buffer;
+    if (*line == '\0') continue;
+    char **lines = (char **)realloc(this->lines, (this->count + 1) * sizeof(char *));
+    if (lines == NULL) break;
+    this->lines = lines;
+    this->lines[this->count] = strdup(line);
+    if (this->lines[this->count] == NULL) break;
+    this->count++;
+  }
+  fclose(file);
+  return true;
+}
+
+static void BenchCorpus_free(BenchCorpus *this) {
+  for (size_t i = 0; i < this->count; i++) free(this->lines[i]);
+  free(this->lines);
+  memset(this, 0, sizeof(BenchCorpus));
+}
+
+/**
+ * Generates the given number of unique keys of the given kind
+ */
+static bool BenchKeys_init(BenchKeys *this, BenchKeyKind kind, size_t count, const BenchCorpus *corpus) {
+  // UTF-8 lines are up to 64 bytes, and get a numeric suffix
+  size_t maxLength = (kind == BENCH_KEYS_UTF8) ? 96 : 24;
+  this->data = (char *)malloc(count * maxLength);
+  this->offsets = (size_t *)malloc(count * sizeof(size_t));
+  this->lengths = (size_t *)malloc(count * sizeof(size_t));
+  this->count = count;
+  if (this->data == NULL || this->offsets == NULL || this->lengths == NULL) return false;
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  size_t offset = 0;
+  for (size_t i = 0; i < count; i++) {
+    char *key = this->data + offset;
+    size_t length = 0;
+    switch (kind) {
+      case BENCH_KEYS_SHORT:
+        length = (size_t)snprintf(key, maxLength, "key:%zu", i);
+        break;
+      case BENCH_KEYS_UTF8: {
+        const char *line = corpus->lines[i % corpus->count];
+        length = (size_t)snprintf(key, maxLength, "%.64s:%zu", line, i / corpus->count);
+        break;
+      }
+      case BENCH_KEYS_BINARY: {
+        // The index makes the key unique, the rest is random
+        uint64_t random = Bench_random(&state);
+        memcpy(key, &i, sizeof(uint64_t));
+        memcpy(key + 8, &random, sizeof(uint64_t));
+        length = 16;
+        break;
+      }
+    }
+    if (length >= maxLength) length = maxLength - 1;
+    this->offsets[i] = offset;
+    this->lengths[i] = length;
+    offset += length;
+  }
+  return true;
+}
+
+static void BenchKeys_free(BenchKeys *this) {
+  free(this->data);
+  free(this->offsets);
+  free(this->lengths);
+  memset(this, 0, sizeof(BenchKeys));
+}
+
+static inline const char *BenchKeys_key(const BenchKeys *this, size_t index) {
+  return this->data + this->offsets[index];
+}
+
+/**
+ * Visits the items in an order that doesn't follow the insertion order,
+ * stepping by a prime that doesn't divide the count
+ */
+static size_t Bench_step(size_t count) {
+  static const size_t primes[] = {1000003, 999983, 7919};
+  for (size_t i = 0; i < 3; i++) {
+    if (count % primes[i] != 0) return primes[i] % count;
+  }
+  return 1;
+}
+
+static void BenchLatency_reset(BenchLatency *this, size_t operations) {
+  this->count = 0;
+  this->every = (operations > BENCH_SAMPLES) ? operations / BENCH_SAMPLES : 1;
+}
+
+static uint64_t BenchLatency_percentile(BenchLatency *this, double percentile) {
+  if (this->count == 0) return 0;
+  size_t index = (size_t)(percentile * (double)(this->count - 1));
+  return this->samples[index];
+}
+
+/**
+ * Prints a result line
+ */
+static void Bench_report(BenchConfig *config, BenchEngine engine, BenchKeyKind kind, size_t size, const char *operation, size_t operations, uint64_t elapsed, BenchLatency *latency) {
+  double seconds = (double)elapsed / 1e9;
+  double throughput = (seconds > 0) ? (double)operations / seconds : 0;
+  uint64_t p50 = 0, p99 = 0;
+  if (latency != NULL && latency->count > 0) {
+    qsort(latency->samples, latency->count, sizeof(uint64_t), Bench_compare);
+    p50 = BenchLatency_percentile(latency, 0.50);
+    p99 = BenchLatency_percentile(latency, 0.99);
+  }
+  if (config->json) {
+    printf("%s\n  {\"engine\": \"%s\", \"keys\": \"%s\", \"size\": %zu, \"operation\": \"%s\", "
+      "\"operations\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.0f, ",
+      config->first ? "" : ",", BenchEngine_names[engine], BenchKeyKind_names[kind], size, operation,
+      operations, seconds, throughput);
+    if (latency != NULL) {
+      printf("\"p50_ns\": %llu, \"p99_ns\": %llu}", (unsigned long long)p50, (unsigned long long)p99);
+    } else {
+      printf("\"p50_ns\": null, \"p99_ns\": null}");
+    }
+  } else {
+    printf("%s,%s,%zu,%s,%zu,%.6f,%.0f,", BenchEngine_names[engine], BenchKeyKind_names[kind], size, operation,
+      operations, seconds, throughput);
+    if (latency != NULL) {
+      printf("%llu,%llu\n", (unsigned long long)p50, (unsigned long long)p99);
+    } else {
+      printf(",\n");
+    }
+  }
+  config->first = false;
+  fflush(stdout);
+}
+
+static Hash *Bench_newHash(BenchEngine engine) {
+  HashOptions options = {
+    .backend = (engine == BENCH_OPEN) ? HASH_OPEN : HASH_CHAINED,
+    .arena = (engine == BENCH_ARENA),
+  };
+  return Hash_newWith(&options);
+}
+
+/**
+ * Inserts the first size keys, optionally measuring the latency
+ */
+static bool Bench_fill(Hash *hash, const BenchKeys *keys, size_t size, size_t seed, BenchLatency *latency) {
+  if (latency != NULL) BenchLatency_reset(latency, size);
+  for (size_t i = 0; i < size; i++) {
+    size_t value = i + seed;
+    bool sampled = (latency != NULL && i % latency->every == 0 && latency->count < BENCH_SAMPLES);
+    uint64_t start = sampled ? Bench_now() : 0;
+    if (!Hash_setn(hash, BenchKeys_key(keys, i), keys->lengths[i], &value, sizeof(value))) return false;
+    if (sampled) latency->samples[latency->count++] = Bench_now() - start;
+  }
+  return true;
+}
+
+/**
+ * Looks up size keys starting from the given one, in a scattered order
+ * Returns the number of keys found
+ */
+static size_t Bench_lookup(const Hash *hash, const BenchKeys *keys, size_t first, size_t size, BenchLatency *latency) {
+  BenchLatency_reset(latency, size);
+  size_t step = Bench_step(size);
+  size_t index = 0;
+  size_t found = 0;
+  for (size_t i = 0; i < size; i++) {
+    size_t key = first + index;
+    bool sampled = (i % latency->every == 0 && latency->count < BENCH_SAMPLES);
+    uint64_t start = sampled ? Bench_now() : 0;
+    if (Hash_getRefn(hash, BenchKeys_key(keys, key), keys->lengths[key]) != NULL) found++;
+    if (sampled) latency->samples[latency->count++] = Bench_now() - start;
+    index += step;
+    if (index >= size) index -= size;
+  }
+  return found;
+}
+
+/**
+ * Runs all the operations for a table size
+ */
+static bool Bench_run(BenchConfig *config, BenchEngine engine, BenchKeyKind kind, size_t size, const BenchKeys *keys, BenchLatency *latency) {
+  Hash *hash = Bench_newHash(engine);
+  if (hash == NULL) return false;
+
+  uint64_t start = Bench_now();
+  bool valid = Bench_fill(hash, keys, size, 0, latency);
+  Bench_report(config, engine, kind, size, "insert", size, Bench_now() - start, latency);
+
+  start = Bench_now();
+  valid = valid && Bench_lookup(hash, keys, 0, size, latency) == size;
+  Bench_report(config, engine, kind, size, "hit", size, Bench_now() - start, latency);
+
+  start = Bench_now();
+  valid = valid && Bench_lookup(hash, keys, size, size, latency) == 0;
+  Bench_report(config, engine, kind, size, "miss", size, Bench_now() - start, latency);
+
+  start = Bench_now();
+  valid = valid && Bench_fill(hash, keys, size, 1, latency);
+  Bench_report(config, engine, kind, size, "overwrite", size, Bench_now() - start, latency);
+
+  start = Bench_now();
+  HashIter iter;
+  HashIter_init(&iter, hash);
+  size_t visited = 0;
+  while (HashIter_next(&iter) != NULL) visited++;
+  Bench_report(config, engine, kind, size, "iterate", visited, Bench_now() - start, NULL);
+
+  start = Bench_now();
+  Hash_free(&hash);
+  Bench_report(config, engine, kind, size, "teardown", size, Bench_now() - start, NULL);
+  if (!valid) return false;
+
+  // Deleting needs a new table
+  hash = Bench_newHash(engine);
+  if (hash == NULL) return false;
+  if (!Bench_fill(hash, keys, size, 0, NULL)) {
+    Hash_free(&hash);
+    return false;
+  }
+  BenchLatency_reset(latency, size);
+  size_t step = Bench_step(size);
+  size_t index = 0;
+  start = Bench_now();
+  for (size_t i = 0; i < size; i++) {
+    bool sampled = (i % latency->every == 0 && latency->count < BENCH_SAMPLES);
+    uint64_t opStart = sampled ? Bench_now() : 0;
+    Hash_deleten(hash, BenchKeys_key(keys, index), keys->lengths[index]);
+    if (sampled) latency->samples[latency->count++] = Bench_now() - opStart;
+    index += step;
+    if (index >= size) index -= size;
+  }
+  Bench_report(config, engine, kind, size, "delete", size, Bench_now() - start, latency);
+  bool empty = Hash_empty(hash);
+  Hash_free(&hash);
+  return empty;
+}
+
+/**
+ * Parses a comma separated list of names into the given flags
+ */
+static bool Bench_parseNames(const char *list, const char **names, size_t count, bool *flags) {
+  memset(flags, 0, count * sizeof(bool));
+  char *copy = strdup(list);
+  if (copy == NULL) return false;
+  bool result = true;
+  for (char *name = strtok(copy, ","); name != NULL; name = strtok(NULL, ",")) {
+    size_t i = 0;
+    while (i < count && strcmp(name, names[i]) != 0) i++;
+    if (i == count) {
+      fprintf(stderr, "Unknown name: %s\n", name);
+      result = false;
+    } else {
+      flags[i] = true;
+    }
+  }
+  free(copy);
+  return result;
+}
+
+static bool Bench_parseSizes(BenchConfig *config, const char *list) {
+  config->sizeCount = 0;
+  const char *cursor = list;
+  while (*cursor != '\0' && config->sizeCount < 32) {
+    char *end;
+    unsigned long long size = strtoull(cursor, &end, 10);
+    if (end == cursor || size == 0) return false;
+    // 1K, 1M and 1G suffixes
+    const char *suffix = strchr("KMG", *end & ~0x20);
+    if (*end != '\0' && suffix != NULL) {
+      for (const char *unit = "KMG"; unit <= suffix; unit++) size *= 1000;
+      end++;
+    }
+    config->sizes[config->sizeCount++] = (size_t)size;
+    if (*end == ',') {
+      end++;
+    } else if (*end != '\0') {
+      return false;
+    }
+    cursor = end;
+  }
+  return config->sizeCount > 0;
+}
+
+static void Bench_usage() {
+  fprintf(stderr,
+    "Usage: bench [--format csv|json] [--sizes 1K,10K,...] [--keys short,utf8,binary]\n"
+    "             [--engines chained,open,arena] [--corpus tests]\n");
+}
+
+int main(int argc, char *argv[]) {
+  BenchConfig config = {.first = true, .keys = {true, true, true}, .engines = {true, true, true}, .corpus = "tests"};
+  bool valid = Bench_parseSizes(&config, BENCH_SIZES);
+  for (int i = 1; valid && i < argc; i++) {
+    if (i + 1 >= argc) {
+      valid = false;
+    } else if (strcmp(argv[i], "--format") == 0) {
+      config.json = (strcmp(argv[++i], "json") == 0);
+      valid = config.json || strcmp(argv[i], "csv") == 0;
+    } else if (strcmp(argv[i], "--sizes") == 0) {
+      valid = Bench_parseSizes(&config, argv[++i]);
+    } else if (strcmp(argv[i], "--keys") == 0) {
+      valid = Bench_parseNames(argv[++i], BenchKeyKind_names, 3, config.keys);
+    } else if (strcmp(argv[i], "--engines") == 0) {
+      valid = Bench_parseNames(argv[++i], BenchEngine_names, 3, config.engines);
+    } else if (strcmp(argv[i], "--corpus") == 0) {
+      config.corpus = argv[++i];
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid) {
+    Bench_usage();
+    return EXIT_FAILURE;
+  }
+
+  BenchCorpus corpus = {0};
+  if (config.keys[BENCH_KEYS_UTF8]) {
+    const char *files[] = {"utf8_1000x16xucs2.txt", "utf8_1000x16xucs4.txt"};
+    char path[1024];
+    for (size_t i = 0; i < 2; i++) {
+      snprintf(path, sizeof(path), "%s/%s", config.corpus, files[i]);
+      if (!BenchCorpus_load(&corpus, path)) fprintf(stderr, "Can't read %s\n", path);
+    }
+    if (corpus.count == 0) {
+      fprintf(stderr, "No UTF-8 corpus found in %s\n", config.corpus);
+      return EXIT_FAILURE;
+    }
+  }
+
+  BenchLatency latency = {0};
+  latency.samples = (uint64_t *)malloc(BENCH_SAMPLES * sizeof(uint64_t));
+  if (latency.samples == NULL) return EXIT_FAILURE;
+
+  if (config.json) {
+    printf("[");
+  } else {
+    printf("engine,keys,size,operation,operations,seconds,ops_per_sec,p50_ns,p99_ns\n");
+  }
+  int status = EXIT_SUCCESS;
+  for (int kind = 0; kind < 3 && status == EXIT_SUCCESS; kind++) {
+    if (!config.keys[kind]) continue;
+    for (size_t s = 0; s < config.sizeCount && status == EXIT_SUCCESS; s++) {
+      size_t size = config.sizes[s];
+      BenchKeys keys = {0};
+      // The second half of the keys is never inserted
+      if (!BenchKeys_init(&keys, (BenchKeyKind)kind, size * 2, &corpus)) {
+        fprintf(stderr, "Not enough memory for %zu keys\n", size * 2);
+        status = EXIT_FAILURE;
+      }
+      for (int engine = 0; engine < 3 && status == EXIT_SUCCESS; engine++) {
+        if (!config.engines[engine]) continue;
+        if (!Bench_run(&config, (BenchEngine)engine, (BenchKeyKind)kind, size, &keys, &latency)) {
+          fprintf(stderr, "Benchmark failed: %s, %s keys, %zu items\n", BenchEngine_names[engine], BenchKeyKind_names[kind], size);
+          status = EXIT_FAILURE;
+        }
+      }
+      BenchKeys_free(&keys);
+    }
+  }
+  if (config.json) printf("\n]\n");
+  free(latency.samples);
+  BenchCorpus_free(&corpus);
+  return status;
+}
@@ -22,66 +22,239 @@
  * USA
  */
 
+#ifdef MACOS
+// Enables memset_s()
+#define __STDC_WANT_LIB_EXT1__ 1
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "hash.h"
+#include "hash_private.h"
+
+#ifndef HASH_REHASH_STEP
+#define HASH_REHASH_STEP 4
+#endif
 
-#ifndef HASH_SIZE
-#define HASH_SIZE 128
+/**
+ * Size of the buffer for short keys and small values inside the nodes
+ * 0 always allocates the key and the value separately
+ */
+#ifndef HASH_INLINE_SIZE
+#define HASH_INLINE_SIZE 32
 #endif
 
 /**
- * A HashNode is a generic struct node, with a pointer to
- * a Tuple structure and a pointer to the next HashNode
- * in the list.
+ * Initial number of entries of an ordered Hash
+ */
+#define HASH_MIN_ENTRIES 16
+
+/**
+ * Number of keys that go through the batched lookup pipeline together
+ */
+#ifndef HASH_BATCH
+#define HASH_BATCH 16
+#endif
+
+void Hash_rehashStep(Hash *this);
+bool Hash_resize(Hash *this, size_t size);
+
+/**
+ * Returns the smallest power of two greater or equal to the given size
+ */
+size_t Hash_tableSize(size_t size) {
+  size_t tableSize = 1;
+  while (tableSize < size) tableSize <<= 1;
+  return tableSize;
+}
+
+static void *HashAllocator_systemAlloc(size_t size, void *context) {
+  (void)context;
+  return malloc(size);
+}
+
+static void *HashAllocator_systemRealloc(void *pointer, size_t size, void *context) {
+  (void)context;
+  return realloc(pointer, size);
+}
+
+static void HashAllocator_systemFree(void *pointer, void *context) {
+  (void)context;
+  free(pointer);
+}
+
+/**
+ * Allocator used when the options don't set one
  */
-typedef struct _Node HashNode;
-typedef struct _Node {
-  HashNode *next; ///< Pointer to the next item in the list
-  Tuple data; ///< Structure that contains the data for the HashNode
-} HashNode;
+static const HashAllocator HashAllocator_system = {
+  .alloc = HashAllocator_systemAlloc,
+  .realloc = HashAllocator_systemRealloc,
+  .free = HashAllocator_systemFree
+};
+
+void *HashAllocator_alloc(const HashAllocator *this, size_t size) {
+  return this->alloc((size > 0) ? size : 1, this->context);
+}
 
 /**
- * A Hash is a sorted set of items,
- * like a dictionary or associative array
+ * Allocates zeroed memory for count items of the given size
  */
-typedef struct _Hash {
-  HashNode *hash[HASH_SIZE]; ///< Hash table array, each item contains a pointer to a HashNode
-  int length; ///< Total length of the Hash
-} Hash;
+void *HashAllocator_calloc(const HashAllocator *this, size_t count, size_t size) {
+  if (size > 0 && count > SIZE_MAX / size) return NULL;
+  void *memory = HashAllocator_alloc(this, count * size);
+  if (memory != NULL) memset(memory, 0, count * size);
+  return memory;
+}
 
-void HashNode_free(HashNode **this);
+void *HashAllocator_realloc(const HashAllocator *this, void *pointer, size_t size) {
+  return this->realloc(pointer, (size > 0) ? size : 1, this->context);
+}
+
+void HashAllocator_free(const HashAllocator *this, void *pointer) {
+  if (pointer != NULL) this->free(pointer, this->context);
+}
 
 /**
  * Creates a new empty Hash and returns its pointer
  */
 Hash *Hash_new() {
-  Hash *this = (Hash *)calloc(sizeof(Hash), 1);
+  return Hash_newWith(NULL);
+}
+
+/**
+ * Returns the allocator set in the options, or the system one
+ * Returns NULL if the allocator set in the options is missing a function
+ */
+const HashAllocator *HashAllocator_for(const HashOptions *options) {
+  if (options == NULL || options->allocator == NULL) return &HashAllocator_system;
+  const HashAllocator *allocator = options->allocator;
+  if (allocator->alloc == NULL || allocator->realloc == NULL || allocator->free == NULL) return NULL;
+  return allocator;
+}
+
+/**
+ * Creates a new empty Hash using the given options and returns its pointer
+ */
+Hash *Hash_newWith(const HashOptions *options) {
+  const HashAllocator *allocator = HashAllocator_for(options);
+  if (allocator == NULL) return NULL;
+  Hash *this = (Hash *)HashAllocator_calloc(allocator, 1, sizeof(Hash));
   if (this == NULL) return NULL;
+  this->allocator = *allocator;
+  size_t defaultSize = Hash_tableSize(HASH_SIZE);
+  size_t size = defaultSize;
+  if (options != NULL && options->capacity > 0) {
+    size = Hash_tableSize(options->capacity);
+  }
+  // Hashes created with a small capacity hint are allowed to stay small
+  this->minSize = (size < defaultSize) ? size : defaultSize;
+  this->function = HashFunction_wyhash;
+  this->wipe = !(options != NULL && options->fastFree);
+  if (options != NULL) {
+    this->threads = options->threads;
+    if (options->function != NULL) this->function = options->function;
+    this->seed[0] = options->seed[0];
+    this->seed[1] = options->seed[1];
+  }
+  this->rehashIndex = -1;
+  if (options != NULL && options->backend == HASH_OPEN) {
+    this->backend = HASH_OPEN;
+    this->minSize = Hash_tableSize(HASH_SIZE);
+    size_t capacity = (options->capacity > 0) ? options->capacity : HASH_SIZE;
+    if (!HashOpen_init(this, capacity)) {
+      Hash_free(&this);
+      return NULL;
+    }
+  } else {
+    this->table[0].buckets = (HashNode **)HashAllocator_calloc(&(this->allocator), size, sizeof(HashNode *));
+    if (this->table[0].buckets == NULL) {
+      Hash_free(&this);
+      return NULL;
+    }
+    this->table[0].size = size;
+  }
+  if (options != NULL && options->ordered) {
+    this->entriesSize = (options->capacity > HASH_MIN_ENTRIES) ? options->capacity : HASH_MIN_ENTRIES;
+    this->entries = (HashNode **)HashAllocator_alloc(&(this->allocator), this->entriesSize * sizeof(HashNode *));
+    if (this->entries == NULL) {
+      Hash_free(&this);
+      return NULL;
+    }
+  }
+  if (options != NULL && options->sorted && !HashSkip_init(this)) {
+    Hash_free(&this);
+    return NULL;
+  }
+  if (options != NULL && options->arena) {
+    this->arena = HashArena_new(&(this->allocator));
+    if (this->arena == NULL) {
+      Hash_free(&this);
+      return NULL;
+    }
+  }
+  if (HASH_STATS && options != NULL && options->stats) {
+    this->counters = HashCounters_new(&(this->allocator));
+    if (this->counters == NULL) Hash_free(&this);
+  }
   return this;
 }
 
+/**
+ * Tells if the given Hash is moving its nodes to a new table
+ */
+bool Hash_rehashing(const Hash *this) {
+  return (this->rehashIndex != -1);
+}
+
 /**
  * Safely deletes all nodes from the given Hash
  * starting from the first node of the last row and going up
  */
 void Hash_purge(Hash *this) {
   if (this->length == 0) return;
-  for (size_t i = 0; i < HASH_SIZE; i++) {
-    HashNode *current = this->hash[i];
-    while(current != NULL) {
-      // Hook the next node as first one, current gets detached
-      this->hash[i] = current->next;
-      current->next = NULL;
-      // Free the detached node
-      HashNode_free(&current);
-      // See if there are other nodes in the same row
-      current = this->hash[i];
+  this->entriesUsed = 0;
+  if (this->sorted != NULL) HashSkip_purge(this);
+  if (Hash_purgeParallel(this)) {
+    this->length = 0;
+    return;
+  }
+  if (this->backend == HASH_OPEN) {
+    HashOpen_purge(this);
+    this->length = 0;
+    return;
+  }
+  if (this->arena != NULL && this->external == 0) {
+    // All the nodes are released with the arena chunks,
+    // the buckets just need to be emptied
+    HashArena_release(this->arena, Hash_wipes(this));
+    for (int t = 0; t < 2; t++) {
+      HashTable *table = &(this->table[t]);
+      if (table->buckets != NULL) memset(table->buckets, 0, table->size * sizeof(HashNode *));
+      table->used = 0;
+    }
+    this->length = 0;
+    return;
+  }
+  for (int t = 0; t < 2; t++) {
+    HashTable *table = &(this->table[t]);
+    for (size_t i = 0; i < table->size; i++) {
+      HashNode *current = table->buckets[i];
+      while(current != NULL) {
+        // Hook the next node as first one, current gets detached
+        table->buckets[i] = current->next;
+        current->next = NULL;
+        // Free the detached node
+        HashNode_free(&current, this);
+        // See if there are other nodes in the same row
+        current = table->buckets[i];
+      }
+      // current node is null, go to next row
     }
-    // current node is null, go to next row
+    table->used = 0;
   }
+  this->length = 0;
 }
 
 /**
@@ -92,14 +265,29 @@ void Hash_free(Hash **this) {
     // First walk the hash and free all its nodes
     // We implicitely trust the developer that didn't mess up
     // with the length attribute of the hash
+    HashMapped_close(*this);
     if (!Hash_empty(*this)) Hash_purge(*this);
 
+    // Free the bucket arrays, table[1] is NULL unless rehashing
+    // The allocator is copied, because the Hash itself is wiped
+    HashAllocator allocator = (*this)->allocator;
+    HashAllocator_free(&allocator, (*this)->table[0].buckets);
+    HashAllocator_free(&allocator, (*this)->table[1].buckets);
+    HashOpen_free(*this);
+    HashAllocator_free(&allocator, (*this)->entries);
+    HashSkip_free(*this);
+    if ((*this)->arena != NULL) {
+      HashArena_release((*this)->arena, Hash_wipes(*this));
+      HashAllocator_free(&allocator, (*this)->arena);
+    }
+    HashAllocator_free(&allocator, (*this)->counters);
+
     // Then free the Hash itself
     // This will erase all data in memory
-    memset(*this, 0, sizeof(Hash));
+    if (Hash_wipes(*this)) Hash_wipe(*this, sizeof(Hash));
     // Free the pointer to which this is pointing
     // which is the actual pointer to the hash
-    free(*this);
+    HashAllocator_free(&allocator, *this);
     *this = NULL;
   }
 }
@@ -118,26 +306,64 @@ int  Hash_length(const Hash *this) {
   return this->length;
 }
 
+/**
+ * Short keys and small values are stored in a buffer of HASH_INLINE_SIZE
+ * bytes at the end of the node: the key first, then the value.
+ * The key size is rounded up so that the value is aligned.
+ */
+static inline size_t HashNode_inlineKeySize(size_t keyLength) {
+  return (keyLength + 1 + 7) & ~(size_t)7;
+}
+
+static inline char *HashNode_inline(HashNode *this) {
+  return (char *)(this + 1);
+}
+
+/**
+ * Returns the inline space for the value, or NULL if the node
+ * has no inline buffer
+ */
+static inline void *HashNode_inlineValue(HashNode *this) {
+  if (this->data.key != HashNode_inline(this)) return NULL;
+  return HashNode_inline(this) + HashNode_inlineKeySize(this->data.keyLength);
+}
+
+static inline size_t HashNode_inlineCapacity(const HashNode *this) {
+  return HASH_INLINE_SIZE - HashNode_inlineKeySize(this->data.keyLength);
+}
+
 /**
  * Creates a new Hash node with the provided key/value/length
+ * The node keeps the hash and the length of the key
  */
-HashNode *HashNode_new(const char *key, const void *value, size_t length) {
-  HashNode *this = (HashNode *)calloc(sizeof(HashNode), 1);
+HashNode *HashNode_new(Hash *hash, const HashKey *key, const void *value, size_t length) {
+  if (hash->arena != NULL) return HashArena_node(hash->arena, key, value, length);
+  bool inlineKey = HashNode_inlineKeySize(key->length) <= HASH_INLINE_SIZE;
+  HashNode *this = (HashNode *)HashAllocator_calloc(&(hash->allocator), 1, sizeof(HashNode) + (inlineKey ? HASH_INLINE_SIZE : 0));
   if (this == NULL) return NULL;
-  // Copy the key as string
-  this->data.key = strdup(key);
+  this->hash = key->hash;
+  this->data.keyLength = key->length;
+  // Copy the key as string, including the NULL terminator
+  this->data.key = inlineKey ? HashNode_inline(this) : (char *)HashAllocator_alloc(&(hash->allocator), key->length + 1);
   if (this->data.key == NULL) {
-    HashNode_free(&this);
+    HashNode_free(&this, hash);
     return NULL;
   }
-  // Allocate memory for the value
-  this->data.value = calloc(length, 1);
-  if (this->data.value == NULL) {
-    memset(this->data.key, 0, strlen(this->data.key) + 1);
-    free(this->data.key);
-    this->data.key = NULL;
-    HashNode_free(&this);
-    return NULL;
+  memcpy(this->data.key, key->data, key->length);
+  this->data.key[key->length] = '\0';
+  // Nodes for borrowed values don't need a buffer
+  if (value == NULL) return this;
+  if (inlineKey && length <= HashNode_inlineCapacity(this)) {
+    this->data.value = HashNode_inlineValue(this);
+    this->capacity = HashNode_inlineCapacity(this);
+  } else {
+    // Allocate memory for the value
+    this->data.value = HashAllocator_alloc(&(hash->allocator), length);
+    if (this->data.value == NULL) {
+      HashNode_free(&this, hash);
+      return NULL;
+    }
+    this->capacity = length;
   }
   this->data.length = length;
   // Copy the actual data for the value
@@ -145,120 +371,678 @@ HashNode *HashNode_new(const char *key, const void *value, size_t length) {
   return this;
 }
 
+/**
+ * Replaces the value stored in the buffer of a node
+ * The value is rewritten in place when it fits in the current buffer,
+ * otherwise the buffer is reallocated; on failure the node is unchanged
+ */
+static bool HashNode_updateCopy(HashNode *this, Hash *hash, const void *value, size_t length) {
+  bool wipe = Hash_wipes(hash);
+  if (hash->arena != NULL) return HashArena_update(hash->arena, this, value, length, wipe);
+  if (this->data.value != NULL && length <= this->capacity) {
+    // The new value may be a part of the current one
+    memmove(this->data.value, value, length);
+    if (wipe && length < this->data.length) {
+      Hash_wipe((unsigned char *)this->data.value + length, this->data.length - length);
+    }
+    this->data.length = length;
+    return true;
+  }
+  void *buffer = NULL;
+  bool inlined = (this->data.value != NULL && this->data.value == HashNode_inlineValue(this));
+  if (wipe || inlined) {
+    // realloc() could leave a copy of the old value in the freed memory,
+    // and inline values can't be reallocated at all
+    buffer = HashAllocator_alloc(&(hash->allocator), length);
+    if (buffer == NULL) return false;
+    memcpy(buffer, value, length);
+    if (this->data.value != NULL && wipe) Hash_wipe(this->data.value, this->data.length);
+    if (!inlined) HashAllocator_free(&(hash->allocator), this->data.value);
+  } else if (this->data.value == NULL) {
+    buffer = HashAllocator_alloc(&(hash->allocator), length);
+    if (buffer == NULL) return false;
+    memcpy(buffer, value, length);
+  } else {
+    buffer = HashAllocator_realloc(&(hash->allocator), this->data.value, length);
+    if (buffer == NULL) return false;
+    memcpy(buffer, value, length);
+  }
+  this->data.value = buffer;
+  this->data.length = length;
+  this->capacity = length;
+  return true;
+}
+
+/**
+ * Points the value of a node back to its own buffer, with zero length
+ */
+static void HashNode_resetValue(HashNode *this, Hash *hash) {
+  this->kind = HASH_VALUE_COPY;
+  this->destroy = NULL;
+  this->data.length = 0;
+  if (hash->arena != NULL) {
+    HashArena_resetValue(this);
+  } else if (HashNode_inlineValue(this) != NULL) {
+    this->data.value = HashNode_inlineValue(this);
+    this->capacity = HashNode_inlineCapacity(this);
+  } else {
+    this->data.value = NULL;
+    this->capacity = 0;
+  }
+}
+
+/**
+ * Releases a value that was not copied by the Hash: owned buffers are
+ * freed, borrowed values are passed to their destructor, if any
+ */
+static void HashNode_releaseExternal(Hash *hash, const HashNode *external) {
+  hash->external -= 1;
+  if (external->kind == HASH_VALUE_BORROWED) {
+    if (external->destroy != NULL) external->destroy(external->data.value, external->data.length);
+  } else {
+    if (Hash_wipes(hash)) Hash_wipe(external->data.value, external->data.length);
+    free(external->data.value);
+  }
+}
+
+/**
+ * Replaces the value of an existing node, the key is not changed
+ * A borrowed or owned value is released only after the new value is
+ * copied, because the new value can be a part of it
+ * On failure the node is unchanged
+ */
+bool HashNode_update(HashNode *this, Hash *hash, const void *value, size_t length) {
+  if (this->kind == HASH_VALUE_COPY) return HashNode_updateCopy(this, hash, value, length);
+  HashNode external = *this;
+  HashNode_resetValue(this, hash);
+  if (!HashNode_updateCopy(this, hash, value, length)) {
+    this->kind = external.kind;
+    this->destroy = external.destroy;
+    this->data.value = external.data.value;
+    this->data.length = external.data.length;
+    this->capacity = external.capacity;
+    return false;
+  }
+  HashNode_releaseExternal(hash, &external);
+  return true;
+}
+
+/**
+ * Releases the value of a node, leaving the node with an empty value
+ * Copies and owned buffers are freed, borrowed values are passed
+ * to their destructor, if any
+ */
+void HashNode_releaseValue(HashNode *this, Hash *hash) {
+  if (this->kind != HASH_VALUE_COPY) {
+    HashNode_releaseExternal(hash, this);
+  } else if (this->data.value != NULL) {
+    if (Hash_wipes(hash)) Hash_wipe(this->data.value, this->data.length);
+    // The arena keeps the value in the same block as the key
+    if (hash->arena == NULL && this->data.value != HashNode_inlineValue(this)) {
+      HashAllocator_free(&(hash->allocator), this->data.value);
+    }
+  }
+  HashNode_resetValue(this, hash);
+}
+
 /**
  * Destroys the given Hash node
  */
-void HashNode_free(HashNode **this) {
+void HashNode_free(HashNode **this, Hash *hash) {
   if (this != NULL) {
+    bool wipe = Hash_wipes(hash);
+    HashNode_releaseValue(*this, hash);
+    if ((*this)->forward != NULL) HashSkip_freeTower(hash, *this);
+    if (hash->arena != NULL) {
+      HashArena_freeNode(hash->arena, *this, wipe);
+      *this = NULL;
+      return;
+    }
     // Cleanup the data memory and free the data pointers
     if ((*this)->data.key != NULL) {
-      memset((*this)->data.key, 0, strlen((*this)->data.key) + 1);
-      free((*this)->data.key);
-    }
-    if ((*this)->data.value != NULL) {
-      memset((*this)->data.value, 0, (*this)->data.length);
-      free((*this)->data.value);
+      if (wipe) Hash_wipe((*this)->data.key, (*this)->data.keyLength + 1);
+      if ((*this)->data.key != HashNode_inline(*this)) HashAllocator_free(&(hash->allocator), (*this)->data.key);
     }
     // Clean memory for the node
-    memset(*this, 0, sizeof(HashNode));
+    if (wipe) Hash_wipe(*this, sizeof(HashNode));
     // Free and NULLify the node pointer
-    free(*this);
+    HashAllocator_free(&(hash->allocator), *this);
     *this = NULL;
   }
 }
 
 /**
- * Computes the hash index for a given key
+ * Adds the memory used by the node to the statistics
+ * Keys and values stored inline and the links of the sorted index
+ * are part of the node, borrowed values are not counted
  */
-int Hash_indexFor(const char *key, size_t size) {
-  int index = 0;
-  size_t keyLength = strlen(key);
-  for (size_t i = 0; i < keyLength; i++) {
-    index += key[i];
+void HashNode_measure(const HashNode *this, const Hash *hash, HashStats *stats) {
+  HashNode *node = (HashNode *)this;
+  bool inlineKey = (hash->arena == NULL && this->data.key == HashNode_inline(node));
+  stats->nodeBytes += sizeof(HashNode) + (inlineKey ? HASH_INLINE_SIZE : 0);
+  // Links of the sorted index
+  if (this->forward != NULL) stats->nodeBytes += this->levels * sizeof(HashNode *);
+  if (!inlineKey) stats->keyBytes += this->data.keyLength + 1;
+  if (this->kind == HASH_VALUE_OWNED) {
+    stats->valueBytes += this->data.length;
+  } else if (this->kind == HASH_VALUE_COPY && (!inlineKey || this->data.value != HashNode_inlineValue(node))) {
+    stats->valueBytes += this->capacity;
   }
-  return index % size;
 }
 
 /**
- * Sets a key/value pair in given Hash
+ * Erases the given memory, the call cannot be optimised away
+ * by the compiler even if the memory is freed right after
  */
-bool Hash_set(Hash *this, const char *key, const void *value, size_t length) {
-  int hashIndex = Hash_indexFor(key, HASH_SIZE);
-  HashNode *node = this->hash[hashIndex];
-  HashNode *prev = NULL;
-  while (node != NULL) {
-    char *currentKey = node->data.key;
-    int comp = strcmp(key, currentKey);
-    if (comp == 0) {
-      // Update existing value
-      // Create a new node and replace the current with the new one
-      HashNode *item = HashNode_new(key, value, length);
-      if (item == NULL) return false;
-      if (prev != NULL) {
-        // Item is not the first item
-        prev->next = item;
-      } else {
-        // Item is at the start of the chain
-        this->hash[hashIndex] = item;
-      }
-      item->next = node->next;
-      node->next = NULL;
-      HashNode_free(&node);
-      return true;
+void Hash_wipe(void *data, size_t size) {
+#if defined(LINUX)
+  explicit_bzero(data, size);
+#elif defined(MACOS)
+  memset_s(data, size, 0, size);
+#else
+  // Calling memset through a volatile pointer prevents the optimisation
+  static void *(*const volatile wipe)(void *, int, size_t) = memset;
+  wipe(data, 0, size);
+#endif
+}
+
+/**
+ * Tells if the node contains the given key
+ * The key bytes are compared only if the hash and the length match
+ */
+bool HashNode_matches(const HashNode *this, const HashKey *key) {
+  return this->hash == key->hash
+    && this->data.keyLength == key->length
+    && memcmp(this->data.key, key->data, key->length) == 0;
+}
+
+/**
+ * Measures and hashes the given key, this is done once per operation
+ */
+HashKey Hash_keyFor(const Hash *this, const void *key, size_t length) {
+  HashKey result = {.data = (const char *)key, .length = length};
+  result.hash = this->function(key, length, this->seed);
+  return result;
+}
+
+/**
+ * Computes the table index for a given hash
+ * The size of the table is a power of two, so the index
+ * is given by the lowest bits of the hash
+ */
+size_t Hash_indexFor(uint64_t hash, size_t size) {
+  return (size_t)(hash & (size - 1));
+}
+
+/**
+ * Starts moving all the nodes to a new table with the given size
+ * The nodes are moved incrementally by Hash_rehashStep()
+ */
+bool Hash_resize(Hash *this, size_t size) {
+  if (Hash_rehashing(this) || size == this->table[0].size) return false;
+  HashNode **buckets = (HashNode **)HashAllocator_calloc(&(this->allocator), size, sizeof(HashNode *));
+  if (buckets == NULL) return false;
+  if (this->table[0].used == 0) {
+    // Nothing to move, just swap the bucket arrays
+    HashAllocator_free(&(this->allocator), this->table[0].buckets);
+    this->table[0].buckets = buckets;
+    this->table[0].size = size;
+    return true;
+  }
+  this->table[1].buckets = buckets;
+  this->table[1].size = size;
+  this->table[1].used = 0;
+  this->rehashIndex = 0;
+  return true;
+}
+
+/**
+ * Moves up to HASH_REHASH_STEP buckets from the old table to the new one
+ * In order to keep the step short on sparse tables, at most
+ * ten empty buckets per step are visited
+ */
+void Hash_rehashStep(Hash *this) {
+  if (!Hash_rehashing(this)) return;
+  HashTable *from = &(this->table[0]);
+  HashTable *to = &(this->table[1]);
+  size_t emptyVisits = HASH_REHASH_STEP * 10;
+  for (int step = 0; step < HASH_REHASH_STEP && from->used > 0; step++) {
+    while (from->buckets[this->rehashIndex] == NULL) {
+      this->rehashIndex++;
+      if (--emptyVisits == 0) return;
+    }
+    // Move the whole chain, each node goes on top of its new bucket
+    HashNode *node = from->buckets[this->rehashIndex];
+    while (node != NULL) {
+      HashNode *next = node->next;
+      size_t hashIndex = Hash_indexFor(node->hash, to->size);
+      node->next = to->buckets[hashIndex];
+      to->buckets[hashIndex] = node;
+      from->used -= 1;
+      to->used += 1;
+      node = next;
     }
-    prev = node;
-    node = node->next;
+    from->buckets[this->rehashIndex] = NULL;
+    this->rehashIndex++;
   }
-  // The new item is appended at the start or end of the list
-  HashNode *item = HashNode_new(key, value, length);
-  if (item == NULL) return false;
-  if (prev == NULL) {
-    this->hash[hashIndex] = item; // The list is empty, add as first item
-    // ^ NOTE: we can't use 'node' here because it's a copy pointer
-    // we need to insert directly into the Hash table
+  if (from->used == 0) {
+    // Rehashing is complete, the new table becomes the main one
+    HashAllocator_free(&(this->allocator), from->buckets);
+    *from = *to;
+    memset(to, 0, sizeof(HashTable));
+    this->rehashIndex = -1;
+  }
+}
+
+/**
+ * Grows the table when the number of items reaches the number of buckets
+ */
+void Hash_expandIfNeeded(Hash *this) {
+  if (Hash_rehashing(this)) return;
+  if ((size_t)this->length >= this->table[0].size) {
+    Hash_resize(this, this->table[0].size * 2);
+  }
+}
+
+/**
+ * Shrinks the table when less than 1/8 of the buckets are used
+ */
+void Hash_shrinkIfNeeded(Hash *this) {
+  if (Hash_rehashing(this)) return;
+  size_t size = this->table[0].size;
+  if (size > this->minSize && (size_t)this->length < size / 8) {
+    size_t newSize = Hash_tableSize(this->length);
+    if (newSize < this->minSize) newSize = this->minSize;
+    Hash_resize(this, newSize);
+  }
+}
+
+/**
+ * Finds the link (bucket slot or next pointer) that points to the node
+ * with the given key in the given table, or NULL if the key is not there
+ * The number of nodes compared with the key is added to compared
+ */
+HashNode **HashTable_find(const HashTable *table, const HashKey *key, size_t *compared) {
+  if (table->used == 0) return NULL;
+  size_t hashIndex = Hash_indexFor(key->hash, table->size);
+  HashNode **link = &(table->buckets[hashIndex]);
+  while (*link != NULL) {
+    *compared += 1;
+    if (HashNode_matches(*link, key)) return link;
+    link = &((*link)->next);
+  }
+  return NULL;
+}
+
+/**
+ * Finds the link to the node with the given key in any of the tables
+ */
+HashNode **Hash_find(const Hash *this, const HashKey *key) {
+  size_t compared = 0;
+  HashNode **link = NULL;
+  if (this->backend == HASH_OPEN) {
+    link = HashOpen_find(this, key, &compared);
   } else {
-    prev->next = item; // No item > new append at the end of the list
+    link = HashTable_find(&(this->table[0]), key, &compared);
+    if (link == NULL && Hash_rehashing(this)) {
+      link = HashTable_find(&(this->table[1]), key, &compared);
+    }
+  }
+  Hash_countLookup(this, link != NULL, compared);
+  return link;
+}
+
+/**
+ * Makes room for a new entry in an ordered Hash
+ * When the entries of the deleted nodes are at least half of the array,
+ * the live ones are moved to the front instead of growing the array
+ */
+static bool Hash_reserveEntry(Hash *this) {
+  if (this->entriesUsed < this->entriesSize) return true;
+  if (this->entriesUsed - (size_t)this->length >= this->entriesSize / 2) {
+    size_t used = 0;
+    for (size_t i = 0; i < this->entriesUsed; i++) {
+      HashNode *node = this->entries[i];
+      if (node == NULL) continue;
+      node->entry = used;
+      this->entries[used++] = node;
+    }
+    this->entriesUsed = used;
+    return true;
+  }
+  size_t size = this->entriesSize * 2;
+  HashNode **entries = (HashNode **)HashAllocator_realloc(&(this->allocator), this->entries, size * sizeof(HashNode *));
+  if (entries == NULL) return false;
+  this->entries = entries;
+  this->entriesSize = size;
+  return true;
+}
+
+/**
+ * Grows the table, and the entries of an ordered Hash, so that
+ * the given number of items fit without resizing
+ * A pending rehash is completed first
+ */
+bool Hash_reserve(Hash *this, size_t capacity) {
+  if (this->mapped != NULL) return false;
+  if (this->entries != NULL && capacity > this->entriesSize) {
+    HashNode **entries = (HashNode **)HashAllocator_realloc(&(this->allocator), this->entries, capacity * sizeof(HashNode *));
+    if (entries == NULL) return false;
+    this->entries = entries;
+    this->entriesSize = capacity;
+  }
+  if (this->backend == HASH_OPEN) return HashOpen_reserve(this, capacity);
+  while (Hash_rehashing(this)) Hash_rehashStep(this);
+  size_t size = Hash_tableSize(capacity);
+  if (size <= this->table[0].size) return true;
+  return Hash_resize(this, size);
+}
+
+/**
+ * Removes a node from the insertion order and from the sorted index
+ * The entry is left empty, so that the order of the others is kept
+ */
+void Hash_unlinkNode(Hash *this, HashNode *node) {
+  if (this->sorted != NULL) HashSkip_remove(this, node);
+  if (this->entries == NULL) return;
+  this->entries[node->entry] = NULL;
+  // Trailing empty entries can be reused straight away
+  while (this->entriesUsed > 0 && this->entries[this->entriesUsed - 1] == NULL) {
+    this->entriesUsed -= 1;
+  }
+}
+
+/**
+ * Adds a node whose key is not in the Hash yet
+ * If the node can't be added, it's destroyed
+ */
+bool Hash_addNode(Hash *this, HashNode *item) {
+  if (this->sorted != NULL && !HashSkip_prepare(this, item)) {
+    HashNode_free(&item, this);
+    return false;
+  }
+  if (this->entries != NULL) {
+    if (!Hash_reserveEntry(this)) {
+      HashNode_free(&item, this);
+      return false;
+    }
+    item->entry = this->entriesUsed;
+    this->entries[this->entriesUsed] = item;
+  }
+  if (this->backend == HASH_OPEN) {
+    if (!HashOpen_insert(this, item)) {
+      HashNode_free(&item, this);
+      return false;
+    }
+    if (this->entries != NULL) this->entriesUsed += 1;
+    if (this->sorted != NULL) HashSkip_insert(this, item);
+    this->length += 1;
+    return true;
   }
+  Hash_expandIfNeeded(this);
+  // New items always go into the newest table
+  HashTable *table = &(this->table[Hash_rehashing(this) ? 1 : 0]);
+  // The new item is appended at the end of the list
+  size_t hashIndex = Hash_indexFor(item->hash, table->size);
+  HashNode **link = &(table->buckets[hashIndex]);
+  while (*link != NULL) link = &((*link)->next);
+  *link = item;
+  table->used += 1;
+  if (this->entries != NULL) this->entriesUsed += 1;
+  if (this->sorted != NULL) HashSkip_insert(this, item);
   this->length += 1;
   return true;
 }
 
 /**
- * Gets the item for the given key, or NULL if the key does not exist
+ * Sets the value for a key whose hash is already computed
  */
-Tuple *Hash_get(const Hash *this, const char *key) {
-  if (this->length > 0) {
-    int hashIndex = Hash_indexFor(key, HASH_SIZE);
-    HashNode *node = this->hash[hashIndex];
-    while (node != NULL) {
-      int comp = strcmp(key, node->data.key);
-      if (comp == 0) {
-        Tuple *data = malloc(sizeof(Tuple));
-        memcpy(data, &(node->data), sizeof(Tuple));
-        return data;
-      }
-      node = node->next;
+bool Hash_setKey(Hash *this, const HashKey *key, const void *value, size_t length) {
+  // Mapped hashes are read-only
+  if (this->mapped != NULL) return false;
+  Hash_rehashStep(this);
+  HashNode **link = Hash_find(this, key);
+  if (link != NULL) {
+    // Update existing value, the node and the key are reused
+    return HashNode_update(*link, this, value, length);
+  }
+  HashNode *item = HashNode_new(this, key, value, length);
+  if (item == NULL) return false;
+  return Hash_addNode(this, item);
+}
+
+/**
+ * Sets a key/value pair in given Hash, for a key of the given length
+ */
+bool Hash_setn(Hash *this, const void *key, size_t keyLength, const void *value, size_t length) {
+  HashKey hashKey = Hash_keyFor(this, key, keyLength);
+  return Hash_setKey(this, &hashKey, value, length);
+}
+
+/**
+ * Sets a key/value pair in given Hash
+ */
+bool Hash_set(Hash *this, const char *key, const void *value, size_t length) {
+  return Hash_setn(this, key, strlen(key), value, length);
+}
+
+/**
+ * Stores a value that is not copied, for an existing or a new key
+ * Returns false if a new node could not be allocated
+ */
+bool Hash_adopt(Hash *this, const char *key, void *value, size_t length, HashValueKind kind, HashDestructor destroy) {
+  if (this->mapped != NULL) return false;
+  Hash_rehashStep(this);
+  HashKey hashKey = Hash_keyFor(this, key, strlen(key));
+  HashNode **link = Hash_find(this, &hashKey);
+  HashNode *node = NULL;
+  HashNode external = {0};
+  bool replaced = false;
+  if (link != NULL) {
+    // The node and the key are reused, a borrowed or owned value is
+    // released once the new one is stored, since they can be the same
+    node = *link;
+    if (node->kind == HASH_VALUE_COPY) {
+      HashNode_releaseValue(node, this);
+    } else {
+      external = *node;
+      replaced = true;
     }
+  } else {
+    node = HashNode_new(this, &hashKey, NULL, 0);
+    if (node == NULL || !Hash_addNode(this, node)) return false;
+  }
+  node->data.value = value;
+  node->data.length = length;
+  node->kind = kind;
+  node->destroy = destroy;
+  this->external += 1;
+  if (replaced) {
+    if (external.data.value != value) {
+      HashNode_releaseExternal(this, &external);
+    } else {
+      this->external -= 1;
+    }
+  }
+  return true;
+}
+
+/**
+ * Sets a key/value pair in given Hash without copying the value
+ */
+bool Hash_setRef(Hash *this, const char *key, const void *value, size_t length, HashDestructor destroy) {
+  return Hash_adopt(this, key, (void *)value, length, HASH_VALUE_BORROWED, destroy);
+}
+
+/**
+ * Sets a key/value pair in given Hash, the Hash becomes the owner of the value
+ */
+bool Hash_setOwned(Hash *this, const char *key, void *value, size_t length) {
+  return Hash_adopt(this, key, value, length, HASH_VALUE_OWNED, NULL);
+}
+
+/**
+ * Copies the given Tuple into a new one
+ * Warning: 1) this just create space for the Tuple itself,
+ * not for the actual content
+ * 2) you will need to free the Tuple after use, but the content
+ * will not be freed until the node is freed
+ */
+Tuple *Tuple_copy(const Tuple *item) {
+  if (item == NULL) return NULL;
+  Tuple *data = malloc(sizeof(Tuple));
+  if (data == NULL) return NULL;
+  memcpy(data, item, sizeof(Tuple));
+  return data;
+}
+
+/**
+ * Gets the item for the given key of the given length,
+ * or NULL if the key does not exist
+ * The item is owned by the Hash, nothing is allocated
+ */
+const Tuple *Hash_getRefn(const Hash *this, const void *key, size_t keyLength) {
+  if (this->length > 0) {
+    HashKey hashKey = Hash_keyFor(this, key, keyLength);
+    HashNode **link = Hash_find(this, &hashKey);
+    if (link != NULL) return &((*link)->data);
   }
   // No key was found
   return NULL;
 }
 
+/**
+ * Gets the item for the given key, or NULL if the key does not exist
+ * The item is owned by the Hash, nothing is allocated
+ */
+const Tuple *Hash_getRef(const Hash *this, const char *key) {
+  return Hash_getRefn(this, key, strlen(key));
+}
+
+/**
+ * Copies the item for the given key into the given Tuple
+ * Returns false if the key does not exist
+ */
+bool Hash_getInto(const Hash *this, const char *key, Tuple *item) {
+  if (this->mapped != NULL) {
+    HashKey hashKey = Hash_keyFor(this, key, strlen(key));
+    return HashMapped_find(this, &hashKey, item);
+  }
+  const Tuple *data = Hash_getRef(this, key);
+  if (data == NULL) return false;
+  *item = *data;
+  return true;
+}
+
+/**
+ * Gets the item for the given key of the given length,
+ * or NULL if the key does not exist
+ */
+Tuple *Hash_getn(const Hash *this, const void *key, size_t keyLength) {
+  if (this->mapped != NULL) {
+    HashKey hashKey = Hash_keyFor(this, key, keyLength);
+    Tuple item;
+    return HashMapped_find(this, &hashKey, &item) ? Tuple_copy(&item) : NULL;
+  }
+  return Tuple_copy(Hash_getRefn(this, key, keyLength));
+}
+
+/**
+ * Gets the item for the given key, or NULL if the key does not exist
+ */
+Tuple *Hash_get(const Hash *this, const char *key) {
+  return Hash_getn(this, key, strlen(key));
+}
+
+/**
+ * Prefetches the buckets where the given hash can be
+ */
+void Hash_prefetchBucket(const Hash *this, uint64_t hash) {
+  if (this->backend == HASH_OPEN) {
+    HashOpen_prefetch(this, hash);
+    return;
+  }
+  Hash_prefetch(&(this->table[0].buckets[Hash_indexFor(hash, this->table[0].size)]));
+  if (Hash_rehashing(this)) {
+    Hash_prefetch(&(this->table[1].buckets[Hash_indexFor(hash, this->table[1].size)]));
+  }
+}
+
+/**
+ * Prefetches the first node of the buckets where the given hash can be
+ * The buckets should be in the cache already
+ */
+static void Hash_prefetchChain(const Hash *this, uint64_t hash) {
+  if (this->backend == HASH_OPEN) return;
+  for (int t = 0; t < (Hash_rehashing(this) ? 2 : 1); t++) {
+    const HashNode *node = this->table[t].buckets[Hash_indexFor(hash, this->table[t].size)];
+    if (node != NULL) Hash_prefetch(node);
+  }
+}
+
+/**
+ * Looks up many keys at once
+ * The keys go through the pipeline in batches: first all the keys
+ * of a batch are hashed and their buckets prefetched, then the first
+ * nodes of the chains are prefetched, and only then the chains are
+ * walked, so that the cache misses of different keys overlap
+ */
+size_t Hash_getMany(const Hash *this, const char *const *keys, size_t count, const Tuple **items) {
+  HashKey batch[HASH_BATCH];
+  size_t found = 0;
+  for (size_t start = 0; start < count; start += HASH_BATCH) {
+    size_t size = (count - start < HASH_BATCH) ? count - start : HASH_BATCH;
+    // A mapped Hash has no Tuples to point to, like with Hash_getRef()
+    if (this->length == 0 || this->mapped != NULL) {
+      for (size_t i = 0; i < size; i++) items[start + i] = NULL;
+      continue;
+    }
+    for (size_t i = 0; i < size; i++) {
+      batch[i] = Hash_keyFor(this, keys[start + i], strlen(keys[start + i]));
+      Hash_prefetchBucket(this, batch[i].hash);
+    }
+    for (size_t i = 0; i < size; i++) Hash_prefetchChain(this, batch[i].hash);
+    for (size_t i = 0; i < size; i++) {
+      HashNode **link = Hash_find(this, &batch[i]);
+      items[start + i] = (link != NULL) ? &((*link)->data) : NULL;
+      if (link != NULL) found++;
+    }
+  }
+  return found;
+}
+
+/**
+ * Sets many key/value pairs at once
+ * All the keys of a batch are hashed and their buckets prefetched
+ * before the first one is set
+ */
+size_t Hash_setMany(Hash *this, const char *const *keys, const void *const *values, const size_t *lengths, size_t count) {
+  HashKey batch[HASH_BATCH];
+  size_t stored = 0;
+  for (size_t start = 0; start < count; start += HASH_BATCH) {
+    size_t size = (count - start < HASH_BATCH) ? count - start : HASH_BATCH;
+    for (size_t i = 0; i < size; i++) {
+      batch[i] = Hash_keyFor(this, keys[start + i], strlen(keys[start + i]));
+      Hash_prefetchBucket(this, batch[i].hash);
+    }
+    for (size_t i = 0; i < size; i++) {
+      // A resize can make the prefetch useless, but never wrong
+      if (Hash_setKey(this, &batch[i], values[start + i], lengths[start + i])) stored++;
+    }
+  }
+  return stored;
+}
+
 /**
  * Gets the value for the given key, or NULL if the key does not exist
  */
 void *Hash_getValue(const Hash *this, const char *key) {
-  if (this->length > 0) {
-    int hashIndex = Hash_indexFor(key, HASH_SIZE);
-    HashNode *node = this->hash[hashIndex];
-    while (node != NULL) {
-      int comp = strcmp(key, node->data.key);
-      if (comp == 0) return node->data.value;
-      node = node->next;
-    }
+  if (this->mapped != NULL) {
+    Tuple item;
+    return Hash_getInto(this, key, &item) ? item.value : NULL;
   }
-  // No key was found
-  return NULL;
+  const Tuple *data = Hash_getRef(this, key);
+  return (data != NULL) ? data->value : NULL;
 }
 
 /**
@@ -267,48 +1051,68 @@ void *Hash_getValue(const Hash *this, const char *key) {
  * otherwise returns false
  */
 bool Hash_delete(Hash *this, const char *key) {
+  return Hash_deleten(this, key, strlen(key));
+}
+
+/**
+ * Deletes the item for the given key of the given length
+ */
+bool Hash_deleten(Hash *this, const void *key, size_t keyLength) {
+  if (this->length == 0) return false;
+  HashKey hashKey = Hash_keyFor(this, key, keyLength);
+  return Hash_deleteKey(this, &hashKey);
+}
+
+/**
+ * Deletes the item for a key whose hash is already computed
+ */
+bool Hash_deleteKey(Hash *this, const HashKey *key) {
   if (this->length > 0) {
-    int hashIndex = Hash_indexFor(key, HASH_SIZE);
-    HashNode *node = this->hash[hashIndex];
-    HashNode *prev = NULL;
-    while (node != NULL) {
-      int comp = strcmp(key, node->data.key);
-      if (comp == 0) {
-        // Detach the node
-        if (prev == NULL) {
-          // First of the list
-          this->hash[hashIndex] = node->next; // can be NULL
-        } else {
-          // Mid or end of the list
-          prev->next = node->next; // can be NULL
-          node->next = NULL;
-        }
-        HashNode_free(&node);
-        this->length -= 1;
-        return true;
-      }
-      prev = node;
-      node = node->next;
+    if (this->backend == HASH_OPEN) {
+      if (!HashOpen_delete(this, key)) return false;
+      this->length -= 1;
+      return true;
     }
+    Hash_rehashStep(this);
+    size_t compared = 0;
+    for (int t = 0; t < 2; t++) {
+      HashNode **link = HashTable_find(&(this->table[t]), key, &compared);
+      if (link == NULL) continue;
+      Hash_countLookup(this, true, compared);
+      // Detach the node, the link can become NULL
+      HashNode *node = *link;
+      *link = node->next;
+      node->next = NULL;
+      Hash_unlinkNode(this, node);
+      HashNode_free(&node, this);
+      this->table[t].used -= 1;
+      this->length -= 1;
+      Hash_shrinkIfNeeded(this);
+      return true;
+    }
+    Hash_countLookup(this, false, compared);
   }
   return false;
 }
 
 /**
  * Gets the key/value pair for the first Hash item
+ * While rehashing, the items of the old table come first
  */
-Tuple *Hash_first(const Hash *this) {
+const Tuple *Hash_firstRef(const Hash *this) {
   if (this->length > 0) {
-    for (size_t i = 0; i < HASH_SIZE; i++) {
-      HashNode *node = this->hash[i];
-      if (node != NULL) {
-        // Warning: 1) this just create space for the Tuple itself,
-        // not for the actual content
-        // 2) you will need to free the Tuple after use, but the content
-        // will not be freed until the node is freed
-        Tuple *data = malloc(sizeof(Tuple));
-        memcpy(data, &(node->data), sizeof(Tuple));
-        return data;
+    if (this->sorted != NULL) return &(HashSkip_first(this)->data);
+    if (this->entries != NULL) {
+      for (size_t i = 0; i < this->entriesUsed; i++) {
+        if (this->entries[i] != NULL) return &(this->entries[i]->data);
+      }
+    }
+    if (this->backend == HASH_OPEN) return &(HashOpen_first(this)->data);
+    for (int t = 0; t < 2; t++) {
+      const HashTable *table = &(this->table[t]);
+      for (size_t i = 0; i < table->size; i++) {
+        HashNode *node = table->buckets[i];
+        if (node != NULL) return &(node->data);
       }
     }
   }
@@ -318,23 +1122,25 @@ Tuple *Hash_first(const Hash *this) {
 
 /**
  * Gets the key/value pair for the last Hash item
+ * While rehashing, the items of the new table come last
  */
-Tuple *Hash_last(const Hash *this) {
+const Tuple *Hash_lastRef(const Hash *this) {
   if (this->length > 0) {
-    for (int i = (HASH_SIZE - 1); i >= 0; i--) {
-      HashNode *node = this->hash[i];
-      if (node != NULL) {
-        // Walk the list until the last item
-        while (node->next != NULL) {
-          node = node->next;
+    if (this->sorted != NULL) return &(HashSkip_last(this)->data);
+    // The last entry is never empty
+    if (this->entries != NULL) return &(this->entries[this->entriesUsed - 1]->data);
+    if (this->backend == HASH_OPEN) return &(HashOpen_last(this)->data);
+    for (int t = 1; t >= 0; t--) {
+      const HashTable *table = &(this->table[t]);
+      for (size_t i = table->size; i > 0; i--) {
+        HashNode *node = table->buckets[i - 1];
+        if (node != NULL) {
+          // Walk the list until the last item
+          while (node->next != NULL) {
+            node = node->next;
+          }
+          return &(node->data);
         }
-        // Warning: 1) this just create space for the Tuple itself,
-        // not for the actual content
-        // 2) you will need to free the Tuple after use, but the content
-        // will not be freed until the node is freed
-        Tuple *data = malloc(sizeof(Tuple));
-        memcpy(data, &(node->data), sizeof(Tuple));
-        return data;
       }
     }
   }
@@ -342,6 +1148,70 @@ Tuple *Hash_last(const Hash *this) {
   return NULL;
 }
 
+/**
+ * Sets up the iterator at the start of the given hash
+ */
+void HashIter_init(HashIter *this, const Hash *hash) {
+  this->hash = hash;
+  this->index = 0;
+  this->table = 0;
+  this->node = (hash->sorted != NULL) ? HashSkip_first(hash) : NULL;
+  this->limit = NULL;
+  this->limitLength = 0;
+  this->prefix = false;
+}
+
+/**
+ * Returns the next item of the hash, or NULL at the end
+ * Sorted hashes are visited through the sorted index,
+ * ordered hashes through the entries,
+ * chained tables bucket by bucket, old table first
+ */
+const Tuple *HashIter_next(HashIter *this) {
+  const Hash *hash = this->hash;
+  if (hash == NULL) return NULL;
+  if (hash->mapped != NULL) return HashMapped_next(hash, &(this->index), &(this->item)) ? &(this->item) : NULL;
+  if (hash->sorted != NULL) return HashSkip_next(this);
+  if (hash->entries != NULL) {
+    while (this->index < hash->entriesUsed) {
+      const HashNode *node = hash->entries[this->index++];
+      if (node != NULL) return &(node->data);
+    }
+    return NULL;
+  }
+  if (hash->backend == HASH_OPEN) {
+    HashNode *node = HashOpen_next(hash, &(this->index));
+    return (node != NULL) ? &(node->data) : NULL;
+  }
+  const HashNode *node = (const HashNode *)this->node;
+  while (node == NULL) {
+    const HashTable *table = &(hash->table[this->table]);
+    if (this->index >= table->size) {
+      if (this->table == 1 || !Hash_rehashing(hash)) return NULL;
+      this->table = 1;
+      this->index = 0;
+      continue;
+    }
+    node = table->buckets[this->index++];
+  }
+  this->node = node->next;
+  return &(node->data);
+}
+
+/**
+ * Gets a copy of the first Hash item
+ */
+Tuple *Hash_first(const Hash *this) {
+  return Tuple_copy(Hash_firstRef(this));
+}
+
+/**
+ * Gets a copy of the last Hash item
+ */
+Tuple *Hash_last(const Hash *this) {
+  return Tuple_copy(Hash_lastRef(this));
+}
+
 /**
  * Destroys the given Tuple
  * Only the container, without destroying the associated data
@@ -356,4 +1226,3 @@ void Tuple_free(Tuple **this) {
     *this = NULL;
   }
 }
-
@@ -26,6 +26,8 @@
 #define HASHES_H
 
   #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
 
   /**
    * A Hash is a sorted set of items,
@@ -35,7 +37,8 @@
 
   /**
    * A Tuple contains a key/value pair
-   * The key is a NULL terminated string
+   * The key is always NULL terminated, but binary keys
+   * can contain NULL bytes too
    * The value can be whatever
    * The length is the size of the value data
    */
@@ -43,13 +46,92 @@
     char *key;
     void *value; ///< Pointer to the actual data
     size_t length; ///< Size of the data
+    size_t keyLength; ///< Size of the key, without the NULL terminator
   } Tuple;
 
+  /**
+   * A HashFunction computes the 64 bit hash of the given bytes
+   * The seed is a 128 bit key, functions that don't need it ignore it
+   */
+  typedef uint64_t (*HashFunction)(const void *data, size_t length, const uint64_t seed[2]);
+
+  /**
+   * wyhash, a very fast general purpose function (default)
+   * Only the first half of the seed is used
+   */
+  uint64_t HashFunction_wyhash(const void *data, size_t length, const uint64_t seed[2]);
+
+  /**
+   * SipHash-2-4, a keyed function that resists hash flooding
+   * Use it with a random seed when the keys come from untrusted input
+   */
+  uint64_t HashFunction_siphash(const void *data, size_t length, const uint64_t seed[2]);
+
+  /**
+   * The sum of all the bytes of the key, the original vHashLib function
+   * Anagrams always collide, it is kept for compatibility only
+   */
+  uint64_t HashFunction_sum(const void *data, size_t length, const uint64_t seed[2]);
+
+  /**
+   * Storage engines for a Hash
+   */
+  typedef enum {
+    HASH_CHAINED, ///< Buckets of linked nodes, resized incrementally (default)
+    HASH_OPEN ///< Open addressing with control bytes probed 16 at a time
+  } HashBackend;
+
+  /**
+   * A HashAllocator provides the memory of a Hash: the tables, the nodes,
+   * the keys and the values, for instance from a pool or a NUMA node
+   * Each function gets the context as its last argument
+   * The functions must be thread-safe for a ConcurrentHash, and for the
+   * hashes built or freed on many threads
+   * IntHash, RcuHash and ConcurrentHash use it for all their memory too
+   * Some memory never comes from it: the values given to Hash_setOwned()
+   * must come from malloc() and are freed with free(), the copies returned
+   * by Hash_get() and ConcurrentHash_get() are malloc()ed for the caller,
+   * and Hash_openMapped(), Hash_save(), Hash_loadFile(), Hash_serialize(),
+   * Hash_deserialize() and Hash_buildParallel() use malloc() for their own buffers
+   */
+  typedef struct {
+    void *(*alloc)(size_t size, void *context); ///< Like malloc(), never called with size 0
+    void *(*realloc)(void *pointer, size_t size, void *context); ///< Like realloc(), never called with size 0
+    void (*free)(void *pointer, void *context); ///< Like free(), never called with NULL
+    void *context; ///< User data passed to the functions
+  } HashAllocator;
+
+  /**
+   * Options used to create a new Hash with Hash_newWith()
+   * Zero-initialised fields use the default values
+   */
+  typedef struct {
+    size_t capacity; ///< Expected number of items, used to presize the table
+    HashFunction function; ///< Hash function for the keys, wyhash if NULL
+    uint64_t seed[2]; ///< Seed passed to the hash function
+    HashBackend backend; ///< Storage engine, HASH_CHAINED by default
+    bool arena; ///< Allocate the items from large slabs, released all at once
+    bool fastFree; ///< Don't wipe the memory of the items when they are freed
+    bool ordered; ///< Remember the insertion order of the items
+    bool sorted; ///< Keep an index of the keys in order, for range scans
+    unsigned threads; ///< Threads used to free the items of big hashes, 0 or 1 frees them serially
+    bool stats; ///< Count the lookups, hits and key comparisons reported by Hash_stats()
+    const HashAllocator *allocator; ///< Memory functions, copied in the Hash; malloc() and free() if NULL
+  } HashOptions;
+
   /**
    * Creates a new Hash and returns a pointer to it
    */
   Hash *Hash_new();
 
+  /**
+   * Creates a new Hash with the given options and returns a pointer to it
+   * Passing NULL is the same as calling Hash_new()
+   * HashOptions options = {.capacity = 100000};
+   * Hash * myhash = Hash_newWith(&options);
+   */
+  Hash *Hash_newWith(const HashOptions *options);
+
   /**
    * Destroys a hash and all its nodes
    * The pointer to a hash pointer should passed
@@ -74,16 +156,90 @@
    */
   bool Hash_set(Hash *this, const char *key, const void *value, size_t length);
 
+  /**
+   * Binary key variants of Hash_set(), Hash_get(), Hash_getRef() and
+   * Hash_delete(): the key is keyLength bytes long and can contain
+   * NULL bytes, like UUIDs or packed structs
+   * Keys are compared byte by byte, so "abc" with length 3
+   * is the same key as the string "abc"
+   */
+  bool Hash_setn(Hash *this, const void *key, size_t keyLength, const void *value, size_t length);
+  Tuple *Hash_getn(const Hash *this, const void *key, size_t keyLength);
+  const Tuple *Hash_getRefn(const Hash *this, const void *key, size_t keyLength);
+  bool Hash_deleten(Hash *this, const void *key, size_t keyLength);
+
+  /**
+   * A HashDestructor is called when a value stored with Hash_setRef()
+   * is deleted, replaced, or the hash is freed
+   */
+  typedef void (*HashDestructor)(void *value, size_t length);
+
+  /**
+   * Sets a key-value pair in the hash without copying the value
+   * The value memory must stay valid until the item is deleted or replaced,
+   * then the destructor, if not NULL, is called with the value
+   */
+  bool Hash_setRef(Hash *this, const char *key, const void *value, size_t length, HashDestructor destroy);
+
+  /**
+   * Sets a key-value pair in the hash using a value allocated with malloc()
+   * The Hash becomes the owner of the value and frees it when the item
+   * is deleted or replaced; on failure the caller still owns it
+   */
+  bool Hash_setOwned(Hash *this, const char *key, void *value, size_t length);
+
   /**
    * Gets the item for the given key, or NULL if the key does not exist
+   * The returned Tuple is a copy that must be freed with Tuple_free()
    */
   Tuple *Hash_get(const Hash *this, const char *key);
 
+  /**
+   * Gets the item for the given key, or NULL if the key does not exist
+   * The returned Tuple belongs to the Hash and must not be freed, it's valid
+   * until the item is updated or deleted, or the hash is freed
+   */
+  const Tuple *Hash_getRef(const Hash *this, const char *key);
+
+  /**
+   * Copies the item for the given key into a caller-provided Tuple
+   * Returns false if the key does not exist
+   */
+  bool Hash_getInto(const Hash *this, const char *key, Tuple *item);
+
   /**
    * Get the value for the given key or NULL if the key don't exist
    */
   void *Hash_getValue(const Hash *this, const char *key);
 
+  /**
+   * Looks up many keys at once, which is faster than calling
+   * Hash_getRef() in a loop because the memory accesses for
+   * different keys are overlapped
+   * Each items[i] is set to the item for keys[i] like Hash_getRef() does,
+   * or NULL; returns the number of keys found
+   * Like Hash_getRef(), it finds nothing in a Hash opened with
+   * Hash_openMapped(): all the items are NULL and it returns 0
+   */
+  size_t Hash_getMany(const Hash *this, const char *const *keys, size_t count, const Tuple **items);
+
+  /**
+   * Sets many key-value pairs at once, like calling Hash_set() for each one
+   * Returns the number of pairs that were stored
+   */
+  size_t Hash_setMany(Hash *this, const char *const *keys, const void *const *values, const size_t *lengths, size_t count);
+
+  /**
+   * Creates a new Hash with the given options and fills it with the
+   * given items, like Hash_setMany(), using the given number of threads
+   * The items are split by the hash of their keys, so that each thread
+   * fills its own range of buckets without locks
+   * Small inputs, the HASH_OPEN backend and the arena, ordered and sorted
+   * options use a single thread
+   * Returns NULL if an item can't be stored
+   */
+  Hash *Hash_buildParallel(const HashOptions *options, const char *const *keys, const void *const *values, const size_t *lengths, size_t count, unsigned threads);
+
   /**
    * Deletes the node at the corresponding key
    * Returns true if the item did exist and was deleted successfully
@@ -92,7 +248,10 @@
   bool Hash_delete(Hash *this, const char *key);
 
   /**
-   * Return the first element from the ordered hash as a tuple key/value
+   * Return the first element from the hash as a tuple key/value
+   * For hashes created with the sorted option it's the smallest key,
+   * with the ordered option it's the oldest item,
+   * otherwise it's the first item in the table
    */
   Tuple *Hash_first(const Hash *this);
 
@@ -101,11 +260,354 @@
    */
   Tuple *Hash_last(const Hash *this);
 
+  /**
+   * Same as Hash_first() and Hash_last(), but the returned Tuple
+   * belongs to the Hash like with Hash_getRef()
+   */
+  const Tuple *Hash_firstRef(const Hash *this);
+  const Tuple *Hash_lastRef(const Hash *this);
+
+  /**
+   * A HashIter visits all the items of a hash, without allocating memory
+   * The items of sorted hashes are visited in key order, the items
+   * of ordered hashes in insertion order, the others in table order
+   * The hash must not be changed while iterating, except for updating
+   * the values of existing items
+   *
+   * HashIter iter;
+   * HashIter_init(&iter, myhash);
+   * const Tuple *item;
+   * while ((item = HashIter_next(&iter)) != NULL) { ... }
+   */
+  typedef struct {
+    const Hash *hash; ///< The hash being visited
+    size_t index; ///< Position of the next bucket, slot or entry
+    int table; ///< Current table of a chained hash
+    const void *node; ///< Next node in the current chain or in the sorted index
+    const char *limit; ///< End of a range scan or prefix, NULL if there is none
+    size_t limitLength; ///< Length of the limit
+    bool prefix; ///< The limit is a prefix
+    Tuple item; ///< Current item of a mapped hash
+  } HashIter;
+
+  /**
+   * Sets up the iterator at the start of the given hash
+   */
+  void HashIter_init(HashIter *this, const Hash *hash);
+
+  /**
+   * Returns the next item, or NULL when all the items have been visited
+   * The item belongs to the hash, like with Hash_getRef()
+   */
+  const Tuple *HashIter_next(HashIter *this);
+
+  /**
+   * Sets up the iterator to visit the keys from low (included)
+   * to high (excluded) in byte order; NULL means no limit
+   * The limits must stay valid while iterating
+   * Returns false and visits nothing if the hash is not sorted
+   */
+  bool Hash_range(const Hash *this, HashIter *iter, const char *low, const char *high);
+
+  /**
+   * Sets up the iterator to visit the keys starting with the given prefix
+   * The prefix must stay valid while iterating
+   * Returns false and visits nothing if the hash is not sorted
+   */
+  bool Hash_prefix(const Hash *this, HashIter *iter, const char *prefix);
+
+  /**
+   * Writes the items of the hash to a snapshot file that can be
+   * opened with Hash_openMapped(); returns false on I/O errors or if
+   * the hash uses a custom hash function
+   * The snapshot is written to path.tmp and renamed once it's on the
+   * disk, so the path never holds a partial file
+   * The file is in native byte order, it can only be opened on machines
+   * with the same endianness
+   * The file contains the seed of the hash function in plain text:
+   * anyone who can read it can craft colliding keys for a SipHash
+   * seeded table, so keep it as private as the seed itself
+   */
+  bool Hash_save(const Hash *this, const char *path);
+
+  /**
+   * Opens a snapshot written by Hash_save() as a read-only Hash
+   * The file is mapped in memory and the lookups read it directly, so
+   * opening takes the same time for any number of items: only the header
+   * is checked, and the lookups skip the buckets whose index is broken
+   * Hash_getValue(), Hash_getInto(), Hash_get(), Hash_getn(), Hash_length()
+   * and the iterators work as usual, but the values are read-only;
+   * Hash_set() and the other setters fail, Hash_getRef(), Hash_first()
+   * and Hash_last() return NULL, and Hash_getMany() finds nothing
+   * Returns NULL if the file can't be mapped or is not a valid snapshot
+   */
+  Hash *Hash_openMapped(const char *path);
+
+  /**
+   * Grows the hash so that the given number of items can be added
+   * without resizing the table
+   */
+  bool Hash_reserve(Hash *this, size_t capacity);
+
+  /**
+   * Formats of the text files read by Hash_loadFile()
+   * Lines can end with LF or CRLF, empty lines are skipped
+   */
+  typedef enum {
+    HASH_LINES, ///< Each line is a key, the value is the line number as an int
+    HASH_TSV ///< Each line is a key, a tab and a value, stored as a NULL terminated string
+  } HashFormat;
+
+  /**
+   * Adds the items from the given text file, existing keys are updated
+   * A UTF-8 byte order mark at the start of the file is ignored
+   * Returns false if the file can't be read or an item can't be stored,
+   * the items of the lines before the error are kept
+   */
+  bool Hash_loadFile(Hash *this, const char *path, HashFormat format);
+
+  /**
+   * Callbacks used by Hash_serialize() and Hash_deserialize() to write
+   * and read the stream, for example to a pipe or a socket
+   * A HashReader must read exactly the given number of bytes
+   * Both return false on errors, which stops the (de)serialization
+   */
+  typedef bool (*HashWriter)(const void *data, size_t size, void *context);
+  typedef bool (*HashReader)(void *data, size_t size, void *context);
+
+  /**
+   * Writes the items of the hash as a stream of chunks
+   * The stream is portable between machines, but it doesn't contain the
+   * hash options: the reader hashes the keys with its own function
+   */
+  bool Hash_serialize(const Hash *this, HashWriter write, void *context);
+
+  /**
+   * Adds the items of a stream written by Hash_serialize(), existing keys
+   * are updated; the chunks are parsed on the given number of threads
+   * Returns false if the stream is broken or an item can't be stored,
+   * the items of the chunks before the error are kept
+   */
+  bool Hash_deserialize(Hash *this, HashReader read, void *context, unsigned threads);
+
+  /**
+   * Number of chain lengths counted by Hash_stats(),
+   * the last one includes the longer chains
+   */
+  #define HASH_STATS_CHAINS 8
+
+  /**
+   * Shape and usage of a Hash, filled by Hash_stats()
+   * The lookup counters are kept only for hashes created with the
+   * stats option, and are always zero when the library is compiled
+   * with HASH_STATS=0
+   */
+  typedef struct {
+    size_t buckets; ///< Buckets, or slots with the HASH_OPEN backend, of all the tables
+    size_t items; ///< Number of items
+    double loadFactor; ///< Items per bucket or slot
+    size_t chains[HASH_STATS_CHAINS]; ///< Buckets with N items; with HASH_OPEN, items found after probing N groups
+    size_t maxProbe; ///< Longest chain; with HASH_OPEN, most groups probed to find an item
+    size_t tableBytes; ///< Memory of the bucket and slot arrays
+    size_t nodeBytes; ///< Memory of the nodes, including the keys and values stored inline
+    size_t keyBytes; ///< Memory of the keys stored out of the nodes
+    size_t valueBytes; ///< Memory of the values stored out of the nodes, borrowed values excluded
+    bool counting; ///< The lookup counters are enabled
+    uint64_t lookups; ///< Key searches, including the ones of the setters and Hash_delete()
+    uint64_t hits; ///< Lookups that found the key
+    uint64_t misses; ///< Lookups that didn't find the key
+    uint64_t comparisons; ///< Items compared with the searched keys
+    double comparisonsPerLookup; ///< Average comparisons for each lookup
+  } HashStats;
+
+  /**
+   * Fills the given HashStats, visiting all the buckets of the hash
+   * Useful to spot bad hash functions and keys that collide
+   */
+  void Hash_stats(const Hash *this, HashStats *stats);
+
   /**
    * Destroys the given Tuple
    * Only the container, without destroying the associated data
    * Use HashNode_free() to destroy the data
    */
   void Tuple_free(Tuple **this);
+
+  /**
+   * A ConcurrentHash can be shared between threads
+   * The items are spread over a number of stripes, each one with its own
+   * Hash and reader-writer lock: threads working on different stripes
+   * never wait for each other, and readers of the same stripe
+   * only wait for the writers
+   */
+  typedef struct _ConcurrentHash ConcurrentHash;
+
+  /**
+   * Creates a new ConcurrentHash, the options are used for all the stripes
+   * and the capacity hint is shared between them
+   * The number of stripes is rounded up to a power of two,
+   * 0 uses the default (HASH_STRIPES)
+   */
+  ConcurrentHash *ConcurrentHash_new(const HashOptions *options, size_t stripes);
+
+  /**
+   * Destroys a ConcurrentHash and all its items
+   * No other thread must be using it
+   */
+  void ConcurrentHash_free(ConcurrentHash **this);
+
+  /**
+   * Returns the number of items, which can be out of date
+   * as soon as it's returned if other threads are writing
+   */
+  int ConcurrentHash_length(const ConcurrentHash *this);
+
+  /**
+   * Sets a key-value pair, the value is copied
+   */
+  bool ConcurrentHash_set(ConcurrentHash *this, const char *key, const void *value, size_t length);
+
+  /**
+   * Gets a copy of the value for the given key, or NULL if the key does
+   * not exist; the copy must be released with free()
+   * Values can't be borrowed, because another thread could delete them
+   */
+  void *ConcurrentHash_get(ConcurrentHash *this, const char *key, size_t *length);
+
+  /**
+   * Copies at most size bytes of the value into the given buffer
+   * and sets length to the full length of the value
+   * Returns false if the key does not exist
+   */
+  bool ConcurrentHash_getInto(ConcurrentHash *this, const char *key, void *buffer, size_t size, size_t *length);
+
+  /**
+   * Tells if the given key exists
+   */
+  bool ConcurrentHash_has(ConcurrentHash *this, const char *key);
+
+  /**
+   * Deletes the item for the given key
+   * Returns false if the key does not exist
+   */
+  bool ConcurrentHash_delete(ConcurrentHash *this, const char *key);
+
+  /**
+   * An IntHash maps 64 bit integer keys to fixed-size values
+   * Keys and values are stored in flat arrays, so there is no allocation
+   * for each item, and the keys are hashed with a multiplication
+   */
+  typedef struct _IntHash IntHash;
+
+  /**
+   * Creates a new IntHash for values of valueSize bytes
+   * Only the capacity and fastFree options are used, options can be NULL
+   */
+  IntHash *IntHash_new(size_t valueSize, const HashOptions *options);
+
+  /**
+   * Destroys an IntHash and all its items
+   */
+  void IntHash_free(IntHash **this);
+
+  /**
+   * Returns the number of items
+   */
+  int IntHash_length(const IntHash *this);
+
+  /**
+   * Sets the value for the given key, valueSize bytes are copied
+   * The value can point into the same IntHash, like the pointers
+   * returned by IntHash_get(), even when the table grows
+   */
+  bool IntHash_set(IntHash *this, uint64_t key, const void *value);
+
+  /**
+   * Gets a pointer to the value for the given key, or NULL if the key
+   * does not exist; the pointer is valid until the next change
+   */
+  void *IntHash_get(const IntHash *this, uint64_t key);
+
+  /**
+   * Tells if the given key exists
+   */
+  bool IntHash_has(const IntHash *this, uint64_t key);
+
+  /**
+   * Deletes the item for the given key
+   * Returns false if the key does not exist
+   */
+  bool IntHash_delete(IntHash *this, uint64_t key);
+
+  /**
+   * Visits the items in table order: the position must start at 0,
+   * returns false when there are no more items
+   * size_t position = 0;
+   * while (IntHash_next(ids, &position, &key, &value)) { ... }
+   */
+  bool IntHash_next(const IntHash *this, size_t *position, uint64_t *key, void **value);
+
+  /**
+   * An RcuHash is a thread-safe hash for data that is read much more
+   * often than it's written, like configuration or routing tables
+   * Readers never take locks or wait: each update publishes a new copy
+   * of the item, and the memory of the old one is reclaimed only when
+   * no reader can see it anymore; writers are serialized by a mutex
+   */
+  typedef struct _RcuHash RcuHash;
+
+  /**
+   * Creates a new RcuHash, the backend and arena options are not used
+   */
+  RcuHash *RcuHash_new(const HashOptions *options);
+
+  /**
+   * Destroys an RcuHash and all its items
+   * No other thread must be using it
+   */
+  void RcuHash_free(RcuHash **this);
+
+  /**
+   * Returns the number of items
+   */
+  int RcuHash_length(const RcuHash *this);
+
+  /**
+   * Sets a key-value pair, the value is copied
+   */
+  bool RcuHash_set(RcuHash *this, const char *key, const void *value, size_t length);
+
+  /**
+   * Deletes the item for the given key
+   * Returns false if the key does not exist
+   */
+  bool RcuHash_delete(RcuHash *this, const char *key);
+
+  /**
+   * Start and end a read section in the calling thread
+   * The values returned by RcuHash_getValue() stay valid until the
+   * end of the section, even if the items are deleted in the meantime
+   * Sections can be nested, and should be short
+   */
+  void RcuHash_enter();
+  void RcuHash_leave();
+
+  /**
+   * Gets the value for the given key, or NULL if the key does not exist
+   * Must be called between RcuHash_enter() and RcuHash_leave()
+   */
+  const void *RcuHash_getValue(const RcuHash *this, const char *key, size_t *length);
+
+  /**
+   * Copies at most size bytes of the value into the given buffer
+   * and sets length to the full length of the value
+   * Returns false if the key does not exist
+   */
+  bool RcuHash_getInto(const RcuHash *this, const char *key, void *buffer, size_t size, size_t *length);
+
+  /**
+   * Tells if the given key exists
+   */
+  bool RcuHash_has(const RcuHash *this, const char *key);
 #endif
 
@@ -0,0 +1,248 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * Size of the data area of a regular chunk
+ */
+#ifndef HASH_ARENA_CHUNK_SIZE
+#define HASH_ARENA_CHUNK_SIZE 65536
+#endif
+
+/**
+ * The smallest block is 16 bytes (2^4)
+ */
+#define HASH_ARENA_MIN_CLASS 4
+
+/**
+ * A chunk is a single heap allocation, the data area follows the header
+ * All the chunks of an arena are linked together so that they can
+ * be released without walking the nodes
+ */
+struct _HashChunk {
+  HashChunk *next; ///< Next chunk in the arena
+  size_t size; ///< Size of the data area
+};
+
+/**
+ * Size of the chunk header, rounded up so that the data area is 16 bytes aligned
+ */
+#define HASH_CHUNK_HEADER ((sizeof(HashChunk) + 15) & ~(size_t)15)
+
+#define HashChunk_data(chunk) ((unsigned char *)(chunk) + HASH_CHUNK_HEADER)
+
+/**
+ * Allocates a new chunk with the given data size and links it to the arena
+ */
+static HashChunk *HashArena_chunk(HashArena *this, size_t size) {
+  HashChunk *chunk = (HashChunk *)HashAllocator_alloc(this->allocator, HASH_CHUNK_HEADER + size);
+  if (chunk == NULL) return NULL;
+  chunk->size = size;
+  chunk->next = this->chunks;
+  this->chunks = chunk;
+  this->slabs += 1;
+  return chunk;
+}
+
+/**
+ * Returns the size class for a block of the given size
+ * Each class contains blocks of 2^class bytes
+ */
+static unsigned HashArena_class(size_t size) {
+  unsigned class = HASH_ARENA_MIN_CLASS;
+  while (((size_t)1 << class) < size) class++;
+  return class;
+}
+
+/**
+ * Returns the actual size of the block allocated for the given size
+ */
+static size_t HashArena_blockSize(size_t size) {
+  return (size_t)1 << HashArena_class(size);
+}
+
+/**
+ * Rounds the key size up, so that the value that follows is aligned
+ */
+static size_t HashArena_keySize(size_t keyLength) {
+  return (keyLength + 1 + 7) & ~(size_t)7;
+}
+
+/**
+ * Creates a new empty arena, whose chunks come from the given allocator
+ */
+HashArena *HashArena_new(const HashAllocator *allocator) {
+  HashArena *this = (HashArena *)HashAllocator_calloc(allocator, 1, sizeof(HashArena));
+  if (this != NULL) this->allocator = allocator;
+  return this;
+}
+
+/**
+ * Allocates a block of at least the given size
+ * Blocks are recycled from the free list of their size class, or carved
+ * out of the current chunk; big blocks get a chunk of their own
+ */
+void *HashArena_alloc(HashArena *this, size_t size) {
+  unsigned class = HashArena_class(size);
+  if (class >= HASH_ARENA_CLASSES) return NULL;
+  size_t blockSize = (size_t)1 << class;
+  if (this->freeBlocks[class] != NULL) {
+    void *block = this->freeBlocks[class];
+    memcpy(&(this->freeBlocks[class]), block, sizeof(void *));
+    return block;
+  }
+  if (blockSize > HASH_ARENA_CHUNK_SIZE / 4) {
+    HashChunk *chunk = HashArena_chunk(this, blockSize);
+    return (chunk != NULL) ? HashChunk_data(chunk) : NULL;
+  }
+  if (this->remaining < blockSize) {
+    // The rest of the current chunk is abandoned
+    HashChunk *chunk = HashArena_chunk(this, HASH_ARENA_CHUNK_SIZE);
+    if (chunk == NULL) return NULL;
+    this->cursor = HashChunk_data(chunk);
+    this->remaining = HASH_ARENA_CHUNK_SIZE;
+  }
+  void *block = this->cursor;
+  this->cursor += blockSize;
+  this->remaining -= blockSize;
+  return block;
+}
+
+/**
+ * Puts a block back on the free list for its size class
+ */
+void HashArena_free(HashArena *this, void *block, size_t size) {
+  unsigned class = HashArena_class(size);
+  memcpy(block, &(this->freeBlocks[class]), sizeof(void *));
+  this->freeBlocks[class] = block;
+}
+
+/**
+ * Creates a node with the key and value stored in a single block
+ * The node comes from a slab, or from the list of deleted nodes
+ */
+HashNode *HashArena_node(HashArena *this, const HashKey *key, const void *value, size_t length) {
+  size_t keySize = HashArena_keySize(key->length);
+  unsigned char *block = (unsigned char *)HashArena_alloc(this, keySize + length);
+  if (block == NULL) return NULL;
+  HashNode *node = this->freeNodes;
+  if (node != NULL) {
+    this->freeNodes = node->next;
+  } else {
+    if (this->nodesLeft == 0) {
+      HashChunk *slab = HashArena_chunk(this, HASH_ARENA_CHUNK_SIZE);
+      if (slab == NULL) {
+        HashArena_free(this, block, keySize + length);
+        return NULL;
+      }
+      this->nodes = (HashNode *)HashChunk_data(slab);
+      this->nodesLeft = HASH_ARENA_CHUNK_SIZE / sizeof(HashNode);
+    }
+    node = this->nodes++;
+    this->nodesLeft -= 1;
+  }
+  memset(node, 0, sizeof(HashNode));
+  node->hash = key->hash;
+  node->data.keyLength = key->length;
+  node->data.key = (char *)block;
+  memcpy(node->data.key, key->data, key->length);
+  node->data.key[key->length] = '\0';
+  node->data.value = block + keySize;
+  node->data.length = length;
+  node->capacity = HashArena_blockSize(keySize + length) - keySize;
+  if (length > 0) memcpy(node->data.value, value, length);
+  return node;
+}
+
+/**
+ * Points the value of the node back to its block, with zero length
+ */
+void HashArena_resetValue(HashNode *node) {
+  node->data.value = node->data.key + HashArena_keySize(node->data.keyLength);
+  node->data.length = 0;
+}
+
+/**
+ * Replaces the value of a node
+ * The value is rewritten in place if it fits in the current block,
+ * otherwise the key and the value are moved to a bigger block
+ */
+bool HashArena_update(HashArena *this, HashNode *node, const void *value, size_t length, bool wipe) {
+  size_t keySize = HashArena_keySize(node->data.keyLength);
+  if (length <= node->capacity) {
+    memmove(node->data.value, value, length);
+    if (wipe && length < node->data.length) {
+      Hash_wipe((unsigned char *)node->data.value + length, node->data.length - length);
+    }
+    node->data.length = length;
+    return true;
+  }
+  unsigned char *block = (unsigned char *)HashArena_alloc(this, keySize + length);
+  if (block == NULL) return false;
+  memcpy(block, node->data.key, node->data.keyLength + 1);
+  memcpy(block + keySize, value, length);
+  size_t oldSize = keySize + node->capacity;
+  if (wipe) Hash_wipe(node->data.key, keySize + node->data.length);
+  HashArena_free(this, node->data.key, oldSize);
+  node->data.key = (char *)block;
+  node->data.value = block + keySize;
+  node->data.length = length;
+  node->capacity = HashArena_blockSize(keySize + length) - keySize;
+  return true;
+}
+
+/**
+ * Puts a node and its block back on the free lists,
+ * optionally wiping their content
+ */
+void HashArena_freeNode(HashArena *this, HashNode *node, bool wipe) {
+  size_t keySize = HashArena_keySize(node->data.keyLength);
+  if (wipe) Hash_wipe(node->data.key, keySize + node->data.length);
+  HashArena_free(this, node->data.key, keySize + node->capacity);
+  if (wipe) Hash_wipe(node, sizeof(HashNode));
+  node->next = this->freeNodes;
+  this->freeNodes = node;
+}
+
+/**
+ * Releases all the chunks at once, the arena can be used again
+ */
+void HashArena_release(HashArena *this, bool wipe) {
+  HashChunk *chunk = this->chunks;
+  while (chunk != NULL) {
+    HashChunk *next = chunk->next;
+    // This will erase all data in memory
+    if (wipe) Hash_wipe(chunk, HASH_CHUNK_HEADER + chunk->size);
+    HashAllocator_free(this->allocator, chunk);
+    chunk = next;
+  }
+  const HashAllocator *allocator = this->allocator;
+  memset(this, 0, sizeof(HashArena));
+  this->allocator = allocator;
+}
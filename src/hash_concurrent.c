@@ -0,0 +1,223 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * Default number of stripes
+ */
+#ifndef HASH_STRIPES
+#define HASH_STRIPES 64
+#endif
+
+/**
+ * Stripes are aligned to the cache line size, so that the locks
+ * and the counters of different stripes are never in the same line
+ */
+#define HASH_CACHE_LINE 64
+
+/**
+ * A stripe is a Hash with its own lock and item counter
+ * The counter mirrors the length of the Hash, so that the total length
+ * can be computed without taking the locks
+ */
+typedef struct {
+  _Alignas(HASH_CACHE_LINE) pthread_rwlock_t lock; ///< Protects the Hash
+  Hash *hash; ///< Items of the stripe
+  atomic_int length; ///< Length of the Hash, readable without the lock
+} HashStripe;
+
+struct _ConcurrentHash {
+  HashStripe *stripes; ///< Array of stripes, aligned to a cache line
+  void *memory; ///< Block holding the stripes, as returned by the allocator
+  size_t size; ///< Number of stripes, a power of two
+  unsigned shift; ///< log2(size)
+  HashFunction function; ///< Function used to hash the keys, shared by all stripes
+  uint64_t seed[2]; ///< Seed for the hash function
+  HashAllocator allocator; ///< Memory functions for the wrapper and the stripes
+};
+
+/**
+ * Hashes the given key and returns the stripe where it belongs
+ * The stripe is selected by the highest bits of the hash, because the
+ * lowest ones select the bucket inside the stripe
+ */
+static HashStripe *ConcurrentHash_stripeFor(ConcurrentHash *this, const char *key, HashKey *hashKey) {
+  hashKey->data = key;
+  hashKey->length = strlen(key);
+  hashKey->hash = this->function(key, hashKey->length, this->seed);
+  if (this->shift == 0) return this->stripes;
+  return &(this->stripes[hashKey->hash >> (64 - this->shift)]);
+}
+
+/**
+ * Creates a new ConcurrentHash
+ */
+ConcurrentHash *ConcurrentHash_new(const HashOptions *options, size_t stripes) {
+  if (stripes == 0) stripes = HASH_STRIPES;
+  const HashAllocator *allocator = HashAllocator_for(options);
+  if (allocator == NULL) return NULL;
+  ConcurrentHash *this = (ConcurrentHash *)HashAllocator_calloc(allocator, 1, sizeof(ConcurrentHash));
+  if (this == NULL) return NULL;
+  this->allocator = *allocator;
+  this->size = Hash_tableSize(stripes);
+  while (((size_t)1 << this->shift) < this->size) this->shift++;
+  // The allocator has no alignment parameter, so the block is padded to align the stripes by hand
+  this->memory = HashAllocator_alloc(allocator, this->size * sizeof(HashStripe) + HASH_CACHE_LINE - 1);
+  if (this->memory == NULL) {
+    HashAllocator_free(allocator, this);
+    return NULL;
+  }
+  this->stripes = (HashStripe *)(((uintptr_t)this->memory + HASH_CACHE_LINE - 1) & ~(uintptr_t)(HASH_CACHE_LINE - 1));
+  memset(this->stripes, 0, this->size * sizeof(HashStripe));
+  HashOptions stripeOptions = {0};
+  if (options != NULL) stripeOptions = *options;
+  stripeOptions.capacity = stripeOptions.capacity / this->size;
+  for (size_t i = 0; i < this->size; i++) {
+    HashStripe *stripe = &(this->stripes[i]);
+    stripe->hash = Hash_newWith(&stripeOptions);
+    if (stripe->hash == NULL || pthread_rwlock_init(&(stripe->lock), NULL) != 0) {
+      if (stripe->hash != NULL) Hash_free(&(stripe->hash));
+      // Only the stripes before this one are complete
+      this->size = i;
+      ConcurrentHash_free(&this);
+      return NULL;
+    }
+    atomic_init(&(stripe->length), 0);
+  }
+  this->function = this->stripes[0].hash->function;
+  memcpy(this->seed, this->stripes[0].hash->seed, sizeof(this->seed));
+  return this;
+}
+
+/**
+ * Destroys a ConcurrentHash and all its items
+ */
+void ConcurrentHash_free(ConcurrentHash **this) {
+  if (this != NULL && *this != NULL) {
+    for (size_t i = 0; i < (*this)->size; i++) {
+      HashStripe *stripe = &((*this)->stripes[i]);
+      Hash_free(&(stripe->hash));
+      pthread_rwlock_destroy(&(stripe->lock));
+    }
+    HashAllocator allocator = (*this)->allocator;
+    HashAllocator_free(&allocator, (*this)->memory);
+    HashAllocator_free(&allocator, *this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Returns the sum of the stripe counters
+ */
+int ConcurrentHash_length(const ConcurrentHash *this) {
+  int length = 0;
+  for (size_t i = 0; i < this->size; i++) {
+    length += atomic_load_explicit(&(this->stripes[i].length), memory_order_relaxed);
+  }
+  return length;
+}
+
+/**
+ * Sets a key-value pair, the value is copied
+ */
+bool ConcurrentHash_set(ConcurrentHash *this, const char *key, const void *value, size_t length) {
+  HashKey hashKey;
+  HashStripe *stripe = ConcurrentHash_stripeFor(this, key, &hashKey);
+  pthread_rwlock_wrlock(&(stripe->lock));
+  bool result = Hash_setKey(stripe->hash, &hashKey, value, length);
+  atomic_store_explicit(&(stripe->length), stripe->hash->length, memory_order_relaxed);
+  pthread_rwlock_unlock(&(stripe->lock));
+  return result;
+}
+
+/**
+ * Gets a copy of the value for the given key
+ */
+void *ConcurrentHash_get(ConcurrentHash *this, const char *key, size_t *length) {
+  HashKey hashKey;
+  HashStripe *stripe = ConcurrentHash_stripeFor(this, key, &hashKey);
+  void *value = NULL;
+  pthread_rwlock_rdlock(&(stripe->lock));
+  HashNode **link = Hash_find(stripe->hash, &hashKey);
+  if (link != NULL) {
+    const Tuple *data = &((*link)->data);
+    // Empty values still get a valid pointer
+    value = malloc(data->length > 0 ? data->length : 1);
+    if (value != NULL) {
+      memcpy(value, data->value, data->length);
+      if (length != NULL) *length = data->length;
+    }
+  }
+  pthread_rwlock_unlock(&(stripe->lock));
+  return value;
+}
+
+/**
+ * Copies the value for the given key into the given buffer
+ */
+bool ConcurrentHash_getInto(ConcurrentHash *this, const char *key, void *buffer, size_t size, size_t *length) {
+  HashKey hashKey;
+  HashStripe *stripe = ConcurrentHash_stripeFor(this, key, &hashKey);
+  pthread_rwlock_rdlock(&(stripe->lock));
+  HashNode **link = Hash_find(stripe->hash, &hashKey);
+  if (link != NULL) {
+    const Tuple *data = &((*link)->data);
+    memcpy(buffer, data->value, (data->length < size) ? data->length : size);
+    if (length != NULL) *length = data->length;
+  }
+  pthread_rwlock_unlock(&(stripe->lock));
+  return (link != NULL);
+}
+
+/**
+ * Tells if the given key exists
+ */
+bool ConcurrentHash_has(ConcurrentHash *this, const char *key) {
+  HashKey hashKey;
+  HashStripe *stripe = ConcurrentHash_stripeFor(this, key, &hashKey);
+  pthread_rwlock_rdlock(&(stripe->lock));
+  bool result = (Hash_find(stripe->hash, &hashKey) != NULL);
+  pthread_rwlock_unlock(&(stripe->lock));
+  return result;
+}
+
+/**
+ * Deletes the item for the given key
+ */
+bool ConcurrentHash_delete(ConcurrentHash *this, const char *key) {
+  HashKey hashKey;
+  HashStripe *stripe = ConcurrentHash_stripeFor(this, key, &hashKey);
+  pthread_rwlock_wrlock(&(stripe->lock));
+  bool result = Hash_deleteKey(stripe->hash, &hashKey);
+  atomic_store_explicit(&(stripe->length), stripe->hash->length, memory_order_relaxed);
+  pthread_rwlock_unlock(&(stripe->lock));
+  return result;
+}
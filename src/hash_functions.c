@@ -0,0 +1,200 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+
+/**
+ * Reads 8, 4 or 3 bytes from the given position
+ * Reads go through memcpy so the data does not need to be aligned
+ */
+static inline uint64_t HashFunction_read8(const uint8_t *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t HashFunction_read4(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t HashFunction_read3(const uint8_t *p, size_t length) {
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[length >> 1]) << 8) | p[length - 1];
+}
+
+/**
+ * Multiplies A and B as 128 bit integers and stores
+ * the low 64 bits in A and the high 64 bits in B
+ */
+static inline void HashFunction_multiply(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t result = (__uint128_t)(*a) * (*b);
+  *a = (uint64_t)result;
+  *b = (uint64_t)(result >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), carry = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  carry += lo < t;
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+  *a = lo;
+  *b = hi;
+#endif
+}
+
+static inline uint64_t HashFunction_mix(uint64_t a, uint64_t b) {
+  HashFunction_multiply(&a, &b);
+  return a ^ b;
+}
+
+/**
+ * Default secret for wyhash
+ */
+static const uint64_t HashFunction_wysecret[4] = {
+  0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+  0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+/**
+ * wyhash (final version 4) by Wang Yi, released in the public domain
+ * Only seed[0] is used
+ */
+uint64_t HashFunction_wyhash(const void *data, size_t length, const uint64_t seed[2]) {
+  const uint8_t *p = (const uint8_t *)data;
+  const uint64_t *secret = HashFunction_wysecret;
+  uint64_t state = (seed != NULL) ? seed[0] : 0;
+  state ^= HashFunction_mix(state ^ secret[0], secret[1]);
+  uint64_t a, b;
+  if (length <= 16) {
+    if (length >= 4) {
+      a = (HashFunction_read4(p) << 32) | HashFunction_read4(p + ((length >> 3) << 2));
+      b = (HashFunction_read4(p + length - 4) << 32)
+        | HashFunction_read4(p + length - 4 - ((length >> 3) << 2));
+    } else if (length > 0) {
+      a = HashFunction_read3(p, length);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = length;
+    if (i >= 48) {
+      uint64_t see1 = state, see2 = state;
+      do {
+        state = HashFunction_mix(HashFunction_read8(p) ^ secret[1], HashFunction_read8(p + 8) ^ state);
+        see1 = HashFunction_mix(HashFunction_read8(p + 16) ^ secret[2], HashFunction_read8(p + 24) ^ see1);
+        see2 = HashFunction_mix(HashFunction_read8(p + 32) ^ secret[3], HashFunction_read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i >= 48);
+      state ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      state = HashFunction_mix(HashFunction_read8(p) ^ secret[1], HashFunction_read8(p + 8) ^ state);
+      i -= 16;
+      p += 16;
+    }
+    a = HashFunction_read8(p + i - 16);
+    b = HashFunction_read8(p + i - 8);
+  }
+  a ^= secret[1];
+  b ^= state;
+  HashFunction_multiply(&a, &b);
+  return HashFunction_mix(a ^ secret[0] ^ length, b ^ secret[1]);
+}
+
+#define HashFunction_rotl(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define HashFunction_sipround(v0, v1, v2, v3) \
+  do { \
+    v0 += v1; v1 = HashFunction_rotl(v1, 13); v1 ^= v0; v0 = HashFunction_rotl(v0, 32); \
+    v2 += v3; v3 = HashFunction_rotl(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = HashFunction_rotl(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = HashFunction_rotl(v1, 17); v1 ^= v2; v2 = HashFunction_rotl(v2, 32); \
+  } while (0)
+
+/**
+ * SipHash-2-4 by Jean-Philippe Aumasson and Daniel J. Bernstein
+ * The seed is the 128 bit secret key, it should be random when
+ * the keys come from untrusted input
+ */
+uint64_t HashFunction_siphash(const void *data, size_t length, const uint64_t seed[2]) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t k0 = (seed != NULL) ? seed[0] : 0;
+  uint64_t k1 = (seed != NULL) ? seed[1] : 0;
+  uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+  uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+  uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+  uint64_t v3 = 0x7465646279746573ull ^ k1;
+  const uint8_t *end = p + length - (length % 8);
+  for (; p != end; p += 8) {
+    uint64_t m = HashFunction_read8(p);
+    v3 ^= m;
+    HashFunction_sipround(v0, v1, v2, v3);
+    HashFunction_sipround(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+  // The last block contains the remaining bytes and the length
+  uint64_t b = ((uint64_t)length) << 56;
+  switch (length & 7) {
+    case 7: b |= ((uint64_t)p[6]) << 48; // fall through
+    case 6: b |= ((uint64_t)p[5]) << 40; // fall through
+    case 5: b |= ((uint64_t)p[4]) << 32; // fall through
+    case 4: b |= ((uint64_t)p[3]) << 24; // fall through
+    case 3: b |= ((uint64_t)p[2]) << 16; // fall through
+    case 2: b |= ((uint64_t)p[1]) << 8; // fall through
+    case 1: b |= ((uint64_t)p[0]); break;
+    case 0: break;
+  }
+  v3 ^= b;
+  HashFunction_sipround(v0, v1, v2, v3);
+  HashFunction_sipround(v0, v1, v2, v3);
+  v0 ^= b;
+  v2 ^= 0xff;
+  HashFunction_sipround(v0, v1, v2, v3);
+  HashFunction_sipround(v0, v1, v2, v3);
+  HashFunction_sipround(v0, v1, v2, v3);
+  HashFunction_sipround(v0, v1, v2, v3);
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+ * The original vHashLib hash function: the sum of all the bytes of the key
+ * It is fast but anagrams always collide, so it should only be used
+ * for compatibility
+ */
+uint64_t HashFunction_sum(const void *data, size_t length, const uint64_t seed[2]) {
+  (void)seed;
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < length; i++) {
+    sum += p[i];
+  }
+  return sum;
+}
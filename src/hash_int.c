@@ -0,0 +1,295 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * The smallest table has 8 slots
+ */
+#define HASH_INT_MIN_SIZE 8
+
+/**
+ * An IntHash keeps the keys and the values in two flat arrays,
+ * using linear probing. Key 0 marks an empty slot, so the item with
+ * key 0, if any, is kept in an extra slot at the end of the arrays.
+ */
+struct _IntHash {
+  uint64_t *keys; ///< Keys, size + 1 items
+  unsigned char *values; ///< Values, size + 1 items of valueSize bytes
+  size_t valueSize; ///< Size of each value
+  size_t size; ///< Number of slots, always a power of two
+  unsigned shift; ///< 64 - log2(size)
+  size_t used; ///< Number of items in the slots, without key 0
+  bool hasZero; ///< The item with key 0 exists
+  bool wipe; ///< Erase the values before freeing or deleting them
+  HashAllocator allocator; ///< Memory functions for the arrays
+};
+
+/**
+ * Fibonacci hashing: the key is multiplied by 2^64 / phi,
+ * and the highest bits of the result are the index of the slot
+ */
+static inline size_t IntHash_indexFor(const IntHash *this, uint64_t key) {
+  return (size_t)((key * 0x9e3779b97f4a7c15ull) >> this->shift);
+}
+
+static inline void *IntHash_value(const IntHash *this, size_t index) {
+  return this->values + index * this->valueSize;
+}
+
+/**
+ * Maximum number of items for a table of the given size (3/4 load)
+ */
+static inline size_t IntHash_maxUsed(size_t size) {
+  return size - size / 4;
+}
+
+/**
+ * Allocates the arrays for the given number of slots
+ */
+static bool IntHash_alloc(IntHash *this, size_t size) {
+  uint64_t *keys = (uint64_t *)HashAllocator_calloc(&(this->allocator), size + 1, sizeof(uint64_t));
+  if (keys == NULL) return false;
+  unsigned char *values = (unsigned char *)HashAllocator_alloc(&(this->allocator), (size + 1) * this->valueSize);
+  if (values == NULL) {
+    HashAllocator_free(&(this->allocator), keys);
+    return false;
+  }
+  this->keys = keys;
+  this->values = values;
+  this->size = size;
+  this->shift = 64;
+  while (size > 1) {
+    size >>= 1;
+    this->shift--;
+  }
+  return true;
+}
+
+/**
+ * Finds the slot of the given key, or the empty slot where it should go
+ */
+static size_t IntHash_find(const IntHash *this, uint64_t key) {
+  size_t mask = this->size - 1;
+  size_t index = IntHash_indexFor(this, key);
+  while (this->keys[index] != 0 && this->keys[index] != key) {
+    index = (index + 1) & mask;
+  }
+  return index;
+}
+
+/**
+ * Moves all the items to arrays with the given number of slots
+ */
+static bool IntHash_resize(IntHash *this, size_t size) {
+  IntHash old = *this;
+  if (!IntHash_alloc(this, size)) {
+    *this = old;
+    return false;
+  }
+  for (size_t i = 0; i < old.size; i++) {
+    if (old.keys[i] == 0) continue;
+    size_t index = IntHash_find(this, old.keys[i]);
+    this->keys[index] = old.keys[i];
+    memcpy(IntHash_value(this, index), IntHash_value(&old, i), this->valueSize);
+  }
+  // The item with key 0 stays in the last slot
+  if (old.hasZero) memcpy(IntHash_value(this, this->size), IntHash_value(&old, old.size), this->valueSize);
+  if (Hash_wipes(this)) Hash_wipe(old.values, (old.size + 1) * old.valueSize);
+  HashAllocator_free(&(this->allocator), old.keys);
+  HashAllocator_free(&(this->allocator), old.values);
+  return true;
+}
+
+/**
+ * Creates a new IntHash for values of the given size
+ */
+IntHash *IntHash_new(size_t valueSize, const HashOptions *options) {
+  if (valueSize == 0) return NULL;
+  const HashAllocator *allocator = HashAllocator_for(options);
+  if (allocator == NULL) return NULL;
+  IntHash *this = (IntHash *)HashAllocator_calloc(allocator, 1, sizeof(IntHash));
+  if (this == NULL) return NULL;
+  this->allocator = *allocator;
+  this->valueSize = valueSize;
+  this->wipe = !(options != NULL && options->fastFree);
+  size_t capacity = (options != NULL) ? options->capacity : 0;
+  size_t size = Hash_tableSize(capacity + capacity / 3);
+  if (size < HASH_INT_MIN_SIZE) size = HASH_INT_MIN_SIZE;
+  if (!IntHash_alloc(this, size)) {
+    HashAllocator_free(allocator, this);
+    return NULL;
+  }
+  return this;
+}
+
+/**
+ * Destroys an IntHash and all its items
+ */
+void IntHash_free(IntHash **this) {
+  if (this != NULL && *this != NULL) {
+    if (Hash_wipes(*this)) Hash_wipe((*this)->values, ((*this)->size + 1) * (*this)->valueSize);
+    HashAllocator allocator = (*this)->allocator;
+    HashAllocator_free(&allocator, (*this)->keys);
+    HashAllocator_free(&allocator, (*this)->values);
+    HashAllocator_free(&allocator, *this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Returns the number of items
+ */
+int IntHash_length(const IntHash *this) {
+  return (int)this->used + (this->hasZero ? 1 : 0);
+}
+
+/**
+ * Tells if the given pointer is inside the values of the table
+ */
+static bool IntHash_owns(const IntHash *this, const void *pointer) {
+  uintptr_t address = (uintptr_t)pointer;
+  uintptr_t start = (uintptr_t)this->values;
+  return address >= start && address < start + (this->size + 1) * this->valueSize;
+}
+
+/**
+ * Grows the table for a new key, keeping a copy of the value
+ * if it is inside the values that are going to be freed
+ */
+static bool IntHash_grow(IntHash *this, const void **value, void **copy) {
+  if (IntHash_owns(this, *value)) {
+    *copy = HashAllocator_alloc(&(this->allocator), this->valueSize);
+    if (*copy == NULL) return false;
+    memcpy(*copy, *value, this->valueSize);
+    *value = *copy;
+  }
+  return IntHash_resize(this, this->size * 2);
+}
+
+/**
+ * Sets the value for the given key, the value is copied
+ * The value can be one returned by IntHash_get() for any key
+ */
+bool IntHash_set(IntHash *this, uint64_t key, const void *value) {
+  if (key == 0) {
+    memmove(IntHash_value(this, this->size), value, this->valueSize);
+    this->hasZero = true;
+    return true;
+  }
+  void *copy = NULL;
+  size_t index = IntHash_find(this, key);
+  if (this->keys[index] == 0) {
+    if (this->used + 1 > IntHash_maxUsed(this->size)) {
+      if (!IntHash_grow(this, &value, &copy)) {
+        HashAllocator_free(&(this->allocator), copy);
+        return false;
+      }
+      index = IntHash_find(this, key);
+    }
+    this->keys[index] = key;
+    this->used += 1;
+  }
+  memmove(IntHash_value(this, index), value, this->valueSize);
+  if (copy != NULL && Hash_wipes(this)) Hash_wipe(copy, this->valueSize);
+  HashAllocator_free(&(this->allocator), copy);
+  return true;
+}
+
+/**
+ * Gets a pointer to the value for the given key
+ */
+void *IntHash_get(const IntHash *this, uint64_t key) {
+  if (key == 0) return this->hasZero ? IntHash_value(this, this->size) : NULL;
+  size_t index = IntHash_find(this, key);
+  return (this->keys[index] != 0) ? IntHash_value(this, index) : NULL;
+}
+
+/**
+ * Tells if the given key exists
+ */
+bool IntHash_has(const IntHash *this, uint64_t key) {
+  return IntHash_get(this, key) != NULL;
+}
+
+/**
+ * Deletes the item for the given key
+ * The items that follow in the same cluster are shifted back,
+ * so that no tombstones are needed
+ */
+bool IntHash_delete(IntHash *this, uint64_t key) {
+  if (key == 0) {
+    if (!this->hasZero) return false;
+    if (Hash_wipes(this)) Hash_wipe(IntHash_value(this, this->size), this->valueSize);
+    this->hasZero = false;
+    return true;
+  }
+  size_t mask = this->size - 1;
+  size_t hole = IntHash_find(this, key);
+  if (this->keys[hole] == 0) return false;
+  size_t index = hole;
+  while (true) {
+    index = (index + 1) & mask;
+    if (this->keys[index] == 0) break;
+    size_t ideal = IntHash_indexFor(this, this->keys[index]);
+    // The item can move to the hole if its ideal slot is not
+    // in the cyclic range (hole, index]
+    if (((index - ideal) & mask) >= ((index - hole) & mask)) {
+      this->keys[hole] = this->keys[index];
+      memcpy(IntHash_value(this, hole), IntHash_value(this, index), this->valueSize);
+      hole = index;
+    }
+  }
+  this->keys[hole] = 0;
+  if (Hash_wipes(this)) Hash_wipe(IntHash_value(this, hole), this->valueSize);
+  this->used -= 1;
+  return true;
+}
+
+/**
+ * Gets the item at the given position or after it, and moves
+ * the position past it; returns false when there are no more items
+ */
+bool IntHash_next(const IntHash *this, size_t *position, uint64_t *key, void **value) {
+  while (*position < this->size) {
+    size_t index = (*position)++;
+    if (this->keys[index] == 0) continue;
+    if (key != NULL) *key = this->keys[index];
+    if (value != NULL) *value = IntHash_value(this, index);
+    return true;
+  }
+  if (*position == this->size) {
+    (*position)++;
+    if (this->hasZero) {
+      if (key != NULL) *key = 0;
+      if (value != NULL) *value = IntHash_value(this, this->size);
+      return true;
+    }
+  }
+  return false;
+}
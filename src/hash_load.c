@@ -0,0 +1,130 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * Number of bytes at the start of the file used to estimate the number of lines
+ */
+#define HASH_LOAD_SAMPLE 65536
+
+/**
+ * Buffer used to add the NULL terminator to the values,
+ * reused for all the lines of a file
+ */
+typedef struct {
+  char *data;
+  size_t size;
+} HashLoadBuffer;
+
+/**
+ * Estimates the number of lines from the first HASH_LOAD_SAMPLE bytes
+ */
+static size_t HashLoad_estimate(const unsigned char *data, size_t size) {
+  size_t sample = (size < HASH_LOAD_SAMPLE) ? size : HASH_LOAD_SAMPLE;
+  const unsigned char *cursor = data;
+  const unsigned char *end = data + sample;
+  size_t lines = 1;
+  while ((cursor = memchr(cursor, '\n', (size_t)(end - cursor))) != NULL) {
+    lines++;
+    cursor++;
+  }
+  if (sample == size) return lines;
+  return (size_t)((double)lines * ((double)size / (double)sample));
+}
+
+/**
+ * Stores the value of a TSV line as a NULL terminated string
+ */
+static bool HashLoad_string(Hash *this, const HashKey *key, const unsigned char *value, size_t length, HashLoadBuffer *buffer) {
+  if (length + 1 > buffer->size) {
+    size_t size = (buffer->size > 0) ? buffer->size : 256;
+    while (size < length + 1) size *= 2;
+    char *data = (char *)realloc(buffer->data, size);
+    if (data == NULL) return false;
+    buffer->data = data;
+    buffer->size = size;
+  }
+  memcpy(buffer->data, value, length);
+  buffer->data[length] = '\0';
+  return Hash_setKey(this, key, buffer->data, length + 1);
+}
+
+/**
+ * Adds the item of a non-empty line, without the line terminator
+ */
+static bool HashLoad_line(Hash *this, const unsigned char *line, size_t length, int number, HashFormat format, HashLoadBuffer *buffer) {
+  if (format == HASH_TSV) {
+    const unsigned char *tab = memchr(line, '\t', length);
+    size_t keyLength = (tab != NULL) ? (size_t)(tab - line) : length;
+    HashKey key = Hash_keyFor(this, line, keyLength);
+    // Lines without a tab have an empty value
+    if (tab == NULL) return HashLoad_string(this, &key, line, 0, buffer);
+    return HashLoad_string(this, &key, tab + 1, length - keyLength - 1, buffer);
+  }
+  HashKey key = Hash_keyFor(this, line, length);
+  return Hash_setKey(this, &key, &number, sizeof(number));
+}
+
+/**
+ * Loads the items from a text file
+ * The file is mapped in memory and split with memchr(), the table is
+ * grown once for the estimated number of lines, and the keys are hashed
+ * straight from the mapping
+ */
+bool Hash_loadFile(Hash *this, const char *path, HashFormat format) {
+  if (this->mapped != NULL) return false;
+  const unsigned char *data = NULL;
+  size_t size = 0;
+  if (!Hash_mapFile(path, &data, &size, true)) return false;
+  const unsigned char *cursor = data;
+  const unsigned char *end = data + size;
+  // Skip the UTF-8 byte order mark
+  if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) cursor += 3;
+  if (size > 0) {
+    // The estimate is only a hint, the table still grows if needed
+    Hash_reserve(this, (size_t)this->length + HashLoad_estimate(cursor, (size_t)(end - cursor)));
+  }
+  HashLoadBuffer buffer = {0};
+  bool result = true;
+  int number = 0;
+  while (result && cursor < end) {
+    const unsigned char *newline = memchr(cursor, '\n', (size_t)(end - cursor));
+    const unsigned char *stop = (newline != NULL) ? newline : end;
+    number++;
+    size_t length = (size_t)(stop - cursor);
+    // Windows line terminators
+    if (length > 0 && cursor[length - 1] == '\r') length--;
+    if (length > 0) result = HashLoad_line(this, cursor, length, number, format, &buffer);
+    cursor = (newline != NULL) ? newline + 1 : end;
+  }
+  if (buffer.data != NULL && Hash_wipes(this)) Hash_wipe(buffer.data, buffer.size);
+  free(buffer.data);
+  Hash_unmapFile(data, size);
+  return result;
+}
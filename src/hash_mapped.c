@@ -0,0 +1,443 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * A snapshot file contains, in native byte order:
+ * - the header
+ * - the bucket starts: buckets + 1 indexes into the slots, the slots
+ *   of bucket b are the ones from starts[b] to starts[b + 1]
+ * - the slots: the hash of each key and the offset of its record,
+ *   grouped by bucket
+ * - the records: key length, value length, key with the NULL terminator
+ *   and value, each part padded to 8 bytes
+ * All the positions are offsets from the start of the file, so the file
+ * can be mapped anywhere
+ */
+#define HASH_MAPPED_MAGIC "vHashMap"
+#define HASH_MAPPED_VERSION 1
+
+typedef struct {
+  char magic[8]; ///< Always HASH_MAPPED_MAGIC
+  uint32_t version; ///< Format version
+  uint32_t function; ///< Identifier of the hash function
+  uint64_t seed[2]; ///< Seed for the hash function
+  uint64_t count; ///< Number of records
+  uint64_t buckets; ///< Number of buckets, a power of two
+  uint64_t records; ///< Offset of the first record
+  uint64_t size; ///< Size of the file
+} HashMappedHeader;
+
+typedef struct {
+  uint64_t hash; ///< Hash of the key
+  uint64_t offset; ///< Offset of the record
+} HashMappedSlot;
+
+typedef struct {
+  uint64_t keyLength; ///< Size of the key, without the NULL terminator
+  uint64_t length; ///< Size of the value
+} HashMappedRecord;
+
+struct _HashMapped {
+  const unsigned char *data; ///< Start of the mapping
+  size_t size; ///< Size of the mapping
+};
+
+/**
+ * Only the functions provided by the library can be saved,
+ * because the file must be read with the same function
+ */
+static uint32_t HashMapped_functionId(HashFunction function) {
+  if (function == HashFunction_wyhash) return 1;
+  if (function == HashFunction_siphash) return 2;
+  if (function == HashFunction_sum) return 3;
+  return 0;
+}
+
+static HashFunction HashMapped_function(uint32_t id) {
+  switch (id) {
+    case 1: return HashFunction_wyhash;
+    case 2: return HashFunction_siphash;
+    case 3: return HashFunction_sum;
+    default: return NULL;
+  }
+}
+
+static inline uint64_t HashMapped_pad(uint64_t size) {
+  return (size + 7) & ~(uint64_t)7;
+}
+
+static inline const HashMappedHeader *HashMapped_header(const HashMapped *this) {
+  return (const HashMappedHeader *)this->data;
+}
+
+static inline const uint64_t *HashMapped_starts(const HashMapped *this) {
+  return (const uint64_t *)(this->data + sizeof(HashMappedHeader));
+}
+
+static inline const HashMappedSlot *HashMapped_slots(const HashMapped *this) {
+  return (const HashMappedSlot *)(HashMapped_starts(this) + HashMapped_header(this)->buckets + 1);
+}
+
+/**
+ * Reads the record at the given offset into the Tuple
+ * Returns false if the record is outside of the file
+ */
+static bool HashMapped_record(const HashMapped *this, uint64_t offset, Tuple *item) {
+  const HashMappedHeader *header = HashMapped_header(this);
+  if (offset < header->records || offset % 8 != 0 || this->size - offset < sizeof(HashMappedRecord)) return false;
+  const HashMappedRecord *record = (const HashMappedRecord *)(this->data + offset);
+  uint64_t available = this->size - offset - sizeof(HashMappedRecord);
+  if (record->keyLength >= available) return false;
+  uint64_t keySize = HashMapped_pad(record->keyLength + 1);
+  if (keySize > available || record->length > available - keySize) return false;
+  // The mapping is read-only, the Tuple must not be used to change it
+  item->key = (char *)(record + 1);
+  item->keyLength = record->keyLength;
+  item->value = (char *)(record + 1) + keySize;
+  item->length = record->length;
+  return true;
+}
+
+/**
+ * Checks that the header is consistent with the file size, so that the index
+ * lies inside the mapping; the bucket starts are checked by HashMapped_bucket(),
+ * so that opening a file doesn't read the whole index
+ */
+static bool HashMapped_valid(const HashMapped *this) {
+  if (this->size < sizeof(HashMappedHeader)) return false;
+  const HashMappedHeader *header = HashMapped_header(this);
+  if (memcmp(header->magic, HASH_MAPPED_MAGIC, 8) != 0) return false;
+  if (header->version != HASH_MAPPED_VERSION || header->size != this->size) return false;
+  if (HashMapped_function(header->function) == NULL) return false;
+  if (header->buckets == 0 || (header->buckets & (header->buckets - 1)) != 0) return false;
+  if (header->buckets > this->size / 8 || header->count > this->size / sizeof(HashMappedSlot)) return false;
+  uint64_t records = sizeof(HashMappedHeader) + (header->buckets + 1) * 8 + header->count * sizeof(HashMappedSlot);
+  return header->records == records && records <= this->size;
+}
+
+/**
+ * Reads the range of slots of the given bucket
+ * Returns false if the range is outside of the slots
+ */
+static bool HashMapped_bucket(const HashMapped *this, uint64_t bucket, uint64_t *start, uint64_t *end) {
+  const uint64_t *starts = HashMapped_starts(this);
+  *start = starts[bucket];
+  *end = starts[bucket + 1];
+  return *start <= *end && *end <= HashMapped_header(this)->count;
+}
+
+/**
+ * Finds the record for the given key in a mapped Hash
+ */
+bool HashMapped_find(const Hash *this, const HashKey *key, Tuple *item) {
+  const HashMapped *map = this->mapped;
+  const HashMappedSlot *slots = HashMapped_slots(map);
+  uint64_t start, end;
+  if (!HashMapped_bucket(map, key->hash & (HashMapped_header(map)->buckets - 1), &start, &end)) return false;
+  for (uint64_t i = start; i < end; i++) {
+    if (slots[i].hash != key->hash) continue;
+    if (!HashMapped_record(map, slots[i].offset, item)) continue;
+    if (item->keyLength == key->length && memcmp(item->key, key->data, key->length) == 0) return true;
+  }
+  return false;
+}
+
+/**
+ * Reads the record of the slot at the given index, and moves the index past it
+ */
+bool HashMapped_next(const Hash *this, size_t *index, Tuple *item) {
+  const HashMapped *map = this->mapped;
+  const HashMappedSlot *slots = HashMapped_slots(map);
+  while (*index < HashMapped_header(map)->count) {
+    if (HashMapped_record(map, slots[(*index)++].offset, item)) return true;
+  }
+  return false;
+}
+
+/**
+ * Adds the shape of a mapped Hash to the statistics
+ * The index is counted as the table, and the records as the nodes
+ */
+void HashMapped_stats(const Hash *this, HashStats *stats) {
+  const HashMapped *map = this->mapped;
+  const HashMappedHeader *header = HashMapped_header(map);
+  stats->buckets += header->buckets;
+  stats->tableBytes += header->records;
+  uint64_t start, end;
+  for (uint64_t b = 0; b < header->buckets; b++) {
+    HashStats_addChain(stats, HashMapped_bucket(map, b, &start, &end) ? end - start : 0);
+  }
+  size_t index = 0;
+  Tuple item;
+  while (HashMapped_next(this, &index, &item)) {
+    stats->nodeBytes += sizeof(HashMappedRecord);
+    stats->keyBytes += HashMapped_pad(item.keyLength + 1);
+    stats->valueBytes += HashMapped_pad(item.length);
+  }
+}
+
+/**
+ * Maps the given file in memory, read-only
+ * Empty files can't be mapped, they get a NULL pointer and size 0
+ * Files that are read sequentially get a hint for the read-ahead
+ */
+bool Hash_mapFile(const char *path, const unsigned char **data, size_t *size, bool sequential) {
+  *data = NULL;
+  *size = 0;
+#if defined(WIN32)
+  (void)sequential;
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return false;
+  bool result = false;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    long length = ftell(file);
+    unsigned char *buffer = (length > 0) ? (unsigned char *)malloc((size_t)length) : NULL;
+    if (length == 0) {
+      result = true;
+    } else if (buffer != NULL && fseek(file, 0, SEEK_SET) == 0 && fread(buffer, 1, (size_t)length, file) == (size_t)length) {
+      *data = buffer;
+      *size = (size_t)length;
+      result = true;
+    } else {
+      free(buffer);
+    }
+  }
+  fclose(file);
+  return result;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < 0) {
+    close(fd);
+    return false;
+  }
+  if (info.st_size == 0) {
+    close(fd);
+    return true;
+  }
+  void *mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the file is closed
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+  if (sequential) madvise(mapping, (size_t)info.st_size, MADV_SEQUENTIAL);
+  *data = (const unsigned char *)mapping;
+  *size = (size_t)info.st_size;
+  return true;
+#endif
+}
+
+/**
+ * Releases a file mapped with Hash_mapFile()
+ */
+void Hash_unmapFile(const unsigned char *data, size_t size) {
+  if (data == NULL) return;
+#if defined(WIN32)
+  (void)size;
+  free((void *)data);
+#else
+  munmap((void *)data, size);
+#endif
+}
+
+/**
+ * Releases the mapping
+ */
+static void HashMapped_free(HashMapped **this) {
+  if (this != NULL && *this != NULL) {
+    Hash_unmapFile((*this)->data, (*this)->size);
+    free(*this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Unmaps the file of a mapped Hash, the Hash becomes empty
+ */
+void HashMapped_close(Hash *this) {
+  if (this->mapped == NULL) return;
+  HashMapped_free(&(this->mapped));
+  this->length = 0;
+}
+
+/**
+ * Opens a snapshot written by Hash_save()
+ */
+Hash *Hash_openMapped(const char *path) {
+  HashMapped *map = (HashMapped *)calloc(sizeof(HashMapped), 1);
+  if (map == NULL) return NULL;
+  Hash *this = NULL;
+  if (Hash_mapFile(path, &(map->data), &(map->size), false) && HashMapped_valid(map)) {
+    const HashMappedHeader *header = HashMapped_header(map);
+    HashOptions options = {
+      .capacity = 1,
+      .function = HashMapped_function(header->function),
+      .seed = {header->seed[0], header->seed[1]},
+      // The items are not in the heap
+      .fastFree = true
+    };
+    this = Hash_newWith(&options);
+  }
+  if (this == NULL) {
+    HashMapped_free(&map);
+    return NULL;
+  }
+  this->mapped = map;
+  this->length = (int)HashMapped_header(map)->count;
+  return this;
+}
+
+/**
+ * Writes the given bytes followed by the zeros that pad them to 8 bytes
+ */
+static bool HashMapped_write(FILE *file, const void *data, uint64_t size) {
+  static const char zeros[8] = {0};
+  uint64_t padding = HashMapped_pad(size) - size;
+  return fwrite(data, 1, size, file) == size && fwrite(zeros, 1, padding, file) == padding;
+}
+
+/**
+ * Writes the header, the bucket starts and the slots, then visits
+ * the items again to write the records in the same order as the slots
+ */
+static bool HashMapped_writeFile(FILE *file, const Hash *hash, const HashMappedHeader *header, const uint64_t *starts, const HashMappedSlot *slots) {
+  if (!HashMapped_write(file, header, sizeof(HashMappedHeader))) return false;
+  if (!HashMapped_write(file, starts, (header->buckets + 1) * sizeof(uint64_t))) return false;
+  if (!HashMapped_write(file, slots, header->count * sizeof(HashMappedSlot))) return false;
+  HashIter iter;
+  HashIter_init(&iter, hash);
+  for (uint64_t index = 0; index < header->count; index++) {
+    const Tuple *item = HashIter_next(&iter);
+    if (item == NULL) return false;
+    HashMappedRecord record = {item->keyLength, item->length};
+    if (!HashMapped_write(file, &record, sizeof(record))) return false;
+    if (!HashMapped_write(file, item->key, item->keyLength + 1)) return false;
+    if (item->length > 0 && !HashMapped_write(file, item->value, item->length)) return false;
+  }
+  return true;
+}
+
+/**
+ * Hashes the keys and groups the slots by bucket
+ * The starts array must be zeroed, the records follow the slots
+ * in the order the items are visited
+ */
+static bool HashMapped_index(const Hash *hash, HashMappedHeader *header, uint64_t *starts, HashMappedSlot *items, HashMappedSlot *slots) {
+  uint64_t mask = header->buckets - 1;
+  uint64_t offset = header->records;
+  HashIter iter;
+  HashIter_init(&iter, hash);
+  for (uint64_t index = 0; index < header->count; index++) {
+    const Tuple *item = HashIter_next(&iter);
+    if (item == NULL) return false;
+    items[index].hash = Hash_keyFor(hash, item->key, item->keyLength).hash;
+    items[index].offset = offset;
+    starts[(items[index].hash & mask) + 1] += 1;
+    offset += sizeof(HashMappedRecord) + HashMapped_pad(item->keyLength + 1) + HashMapped_pad(item->length);
+  }
+  header->size = offset;
+  for (uint64_t b = 0; b < header->buckets; b++) {
+    starts[b + 1] += starts[b];
+  }
+  // Each slot goes after the ones already in its bucket, so that
+  // each start moves to the end of its bucket
+  for (uint64_t i = 0; i < header->count; i++) {
+    slots[starts[items[i].hash & mask]++] = items[i];
+  }
+  memmove(starts + 1, starts, header->buckets * sizeof(uint64_t));
+  starts[0] = 0;
+  return true;
+}
+
+/**
+ * Writes the snapshot to path.tmp, flushed to the disk, then renames it
+ * to the given path, so that the path never holds a partial snapshot
+ */
+static bool HashMapped_save(const char *path, const Hash *hash, const HashMappedHeader *header, const uint64_t *starts, const HashMappedSlot *slots) {
+  size_t length = strlen(path);
+  char *temporary = (char *)malloc(length + 5);
+  if (temporary == NULL) return false;
+  memcpy(temporary, path, length);
+  memcpy(temporary + length, ".tmp", 5);
+  bool result = false;
+  FILE *file = fopen(temporary, "wb");
+  if (file != NULL) {
+    result = HashMapped_writeFile(file, hash, header, starts, slots) && fflush(file) == 0;
+#if !defined(WIN32)
+    if (result) result = (fsync(fileno(file)) == 0);
+#endif
+    if (fclose(file) != 0) result = false;
+#if defined(WIN32)
+    // rename() doesn't replace existing files on Windows
+    if (result) remove(path);
+#endif
+    if (result) result = (rename(temporary, path) == 0);
+    // Don't leave a broken snapshot behind
+    if (!result) remove(temporary);
+  }
+  free(temporary);
+  return result;
+}
+
+/**
+ * Writes a snapshot of the Hash to the given file
+ */
+bool Hash_save(const Hash *this, const char *path) {
+  uint32_t function = HashMapped_functionId(this->function);
+  if (function == 0) return false;
+  HashMappedHeader header = {
+    .version = HASH_MAPPED_VERSION,
+    .function = function,
+    .seed = {this->seed[0], this->seed[1]},
+    .count = (uint64_t)this->length
+  };
+  memcpy(header.magic, HASH_MAPPED_MAGIC, sizeof(header.magic));
+  header.buckets = Hash_tableSize(header.count > 0 ? header.count : 1);
+  header.records = sizeof(HashMappedHeader) + (header.buckets + 1) * 8 + header.count * sizeof(HashMappedSlot);
+  uint64_t *starts = (uint64_t *)calloc(header.buckets + 1, sizeof(uint64_t));
+  HashMappedSlot *items = (HashMappedSlot *)malloc((header.count + 1) * sizeof(HashMappedSlot));
+  HashMappedSlot *slots = (HashMappedSlot *)malloc((header.count + 1) * sizeof(HashMappedSlot));
+  bool result = false;
+  if (starts != NULL && items != NULL && slots != NULL && HashMapped_index(this, &header, starts, items, slots)) {
+    result = HashMapped_save(path, this, &header, starts, slots);
+  }
+  free(starts);
+  free(items);
+  free(slots);
+  return result;
+}
@@ -0,0 +1,376 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * Control byte values: a full slot stores the lowest 7 bits
+ * of the key hash (0-127), empty and deleted slots are negative
+ */
+#define HASH_CTRL_EMPTY ((int8_t)-128)
+#define HASH_CTRL_DELETED ((int8_t)-2)
+
+/**
+ * A bit mask with one bit for each slot of a group
+ */
+typedef uint32_t HashMask;
+
+/**
+ * Returns the position of the lowest bit set in a non-empty mask
+ */
+static inline unsigned HashMask_lowest(HashMask mask) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_ctz(mask);
+#else
+  unsigned position = 0;
+  while ((mask & 1) == 0) {
+    mask >>= 1;
+    position++;
+  }
+  return position;
+#endif
+}
+
+/**
+ * Returns a mask of the slots in the group starting at ctrl
+ * whose control byte is equal to the given value
+ */
+static inline HashMask HashOpen_match(const int8_t *ctrl, int8_t value) {
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return (HashMask)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(value), group));
+#else
+  HashMask mask = 0;
+  for (int i = 0; i < HASH_GROUP_WIDTH; i++) {
+    if (ctrl[i] == value) mask |= (HashMask)1 << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * Returns a mask of the empty or deleted slots in the group starting at ctrl
+ */
+static inline HashMask HashOpen_matchFree(const int8_t *ctrl) {
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return (HashMask)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), group));
+#else
+  HashMask mask = 0;
+  for (int i = 0; i < HASH_GROUP_WIDTH; i++) {
+    if (ctrl[i] < -1) mask |= (HashMask)1 << i;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * Sets the control byte for the given slot,
+ * and its mirror if the slot belongs to the first group
+ */
+static inline void HashOpen_setCtrl(HashOpenTable *table, size_t index, int8_t value) {
+  table->ctrl[index] = value;
+  if (index < HASH_GROUP_WIDTH) table->ctrl[table->size + index] = value;
+}
+
+/**
+ * The hash is split in two parts: the highest 57 bits select the
+ * starting position of the probe, the lowest 7 bits are the tag
+ * stored in the control byte
+ */
+static inline size_t HashOpen_position(uint64_t hash, size_t size) {
+  return (size_t)(hash >> 7) & (size - 1);
+}
+
+static inline int8_t HashOpen_tag(uint64_t hash) {
+  return (int8_t)(hash & 0x7f);
+}
+
+/**
+ * Maximum number of nodes for a table of the given size (7/8 load)
+ */
+static inline size_t HashOpen_maxUsed(size_t size) {
+  return size - size / 8;
+}
+
+/**
+ * Allocates an empty table with the given number of slots
+ */
+static bool HashOpenTable_init(HashOpenTable *table, size_t size, const HashAllocator *allocator) {
+  int8_t *ctrl = (int8_t *)HashAllocator_alloc(allocator, size + HASH_GROUP_WIDTH);
+  if (ctrl == NULL) return false;
+  HashNode **slots = (HashNode **)HashAllocator_calloc(allocator, size, sizeof(HashNode *));
+  if (slots == NULL) {
+    HashAllocator_free(allocator, ctrl);
+    return false;
+  }
+  memset(ctrl, HASH_CTRL_EMPTY, size + HASH_GROUP_WIDTH);
+  table->ctrl = ctrl;
+  table->slots = slots;
+  table->size = size;
+  table->used = 0;
+  table->growthLeft = HashOpen_maxUsed(size);
+  return true;
+}
+
+/**
+ * Finds the first empty or deleted slot for the given hash
+ * The table always has at least one empty slot
+ */
+static size_t HashOpenTable_findFree(const HashOpenTable *table, uint64_t hash) {
+  size_t mask = table->size - 1;
+  size_t position = HashOpen_position(hash, table->size);
+  size_t step = 0;
+  while (true) {
+    HashMask available = HashOpen_matchFree(table->ctrl + position);
+    if (available != 0) return (position + HashMask_lowest(available)) & mask;
+    // Triangular probing visits every group once
+    step += HASH_GROUP_WIDTH;
+    position = (position + step) & mask;
+  }
+}
+
+/**
+ * Stores the node in the first free slot for the given hash
+ */
+static void HashOpenTable_put(HashOpenTable *table, HashNode *node, uint64_t hash) {
+  size_t index = HashOpenTable_findFree(table, hash);
+  if (table->ctrl[index] == HASH_CTRL_EMPTY) table->growthLeft -= 1;
+  HashOpen_setCtrl(table, index, HashOpen_tag(hash));
+  table->slots[index] = node;
+  table->used += 1;
+}
+
+/**
+ * Moves all the nodes to a new table with the given number of slots
+ * Deleted slots are dropped in the process
+ */
+static bool HashOpen_rehash(Hash *this, size_t size) {
+  HashOpenTable table = {0};
+  if (!HashOpenTable_init(&table, size, &(this->allocator))) return false;
+  HashOpenTable *old = &(this->open);
+  for (size_t i = 0; i < old->size; i++) {
+    if (old->ctrl[i] < 0) continue;
+    HashNode *node = old->slots[i];
+    HashOpenTable_put(&table, node, node->hash);
+  }
+  HashAllocator_free(&(this->allocator), old->ctrl);
+  HashAllocator_free(&(this->allocator), old->slots);
+  *old = table;
+  return true;
+}
+
+/**
+ * Grows the table so that the given number of items fit without rehashing
+ */
+bool HashOpen_reserve(Hash *this, size_t capacity) {
+  size_t size = Hash_tableSize(capacity + capacity / 7);
+  if (size <= this->open.size) return true;
+  return HashOpen_rehash(this, size);
+}
+
+/**
+ * Creates the open addressing table for the given number of items
+ */
+bool HashOpen_init(Hash *this, size_t capacity) {
+  size_t size = Hash_tableSize(capacity + capacity / 7);
+  if (size < HASH_GROUP_WIDTH) size = HASH_GROUP_WIDTH;
+  return HashOpenTable_init(&(this->open), size, &(this->allocator));
+}
+
+/**
+ * Finds the slot that points to the node with the given key,
+ * or NULL if the key is not there
+ * The number of nodes compared with the key is added to compared
+ */
+HashNode **HashOpen_find(const Hash *this, const HashKey *key, size_t *compared) {
+  const HashOpenTable *table = &(this->open);
+  if (table->used == 0) return NULL;
+  int8_t tag = HashOpen_tag(key->hash);
+  size_t mask = table->size - 1;
+  size_t position = HashOpen_position(key->hash, table->size);
+  size_t step = 0;
+  while (true) {
+    const int8_t *group = table->ctrl + position;
+    HashMask match = HashOpen_match(group, tag);
+    while (match != 0) {
+      size_t index = (position + HashMask_lowest(match)) & mask;
+      *compared += 1;
+      if (HashNode_matches(table->slots[index], key)) {
+        return &(table->slots[index]);
+      }
+      match &= match - 1;
+    }
+    // An empty slot ends the probe sequence
+    if (HashOpen_match(group, HASH_CTRL_EMPTY) != 0) return NULL;
+    step += HASH_GROUP_WIDTH;
+    position = (position + step) & mask;
+  }
+}
+
+/**
+ * Returns the number of groups probed to find the node in the given slot
+ */
+size_t HashOpen_groupsFor(const Hash *this, size_t index) {
+  const HashOpenTable *table = &(this->open);
+  size_t mask = table->size - 1;
+  size_t position = HashOpen_position(table->slots[index]->hash, table->size);
+  size_t step = 0;
+  size_t groups = 1;
+  while (((index - position) & mask) >= HASH_GROUP_WIDTH) {
+    step += HASH_GROUP_WIDTH;
+    position = (position + step) & mask;
+    groups++;
+  }
+  return groups;
+}
+
+/**
+ * Prefetches the first group of control bytes and slots for the given hash
+ */
+void HashOpen_prefetch(const Hash *this, uint64_t hash) {
+  size_t position = HashOpen_position(hash, this->open.size);
+  Hash_prefetch(this->open.ctrl + position);
+  Hash_prefetch(this->open.slots + position);
+}
+
+/**
+ * Inserts a node whose key is not in the table yet
+ * The table grows when it's 7/8 full, or is just rebuilt
+ * in place when most of the used slots are deleted ones
+ */
+bool HashOpen_insert(Hash *this, HashNode *item) {
+  HashOpenTable *table = &(this->open);
+  if (table->growthLeft == 0) {
+    size_t size = table->size;
+    if (table->used >= HashOpen_maxUsed(size) / 2) size *= 2;
+    if (!HashOpen_rehash(this, size)) return false;
+  }
+  HashOpenTable_put(table, item, item->hash);
+  return true;
+}
+
+/**
+ * Deletes the node with the given key, the slot is marked as deleted
+ * so that the probe sequences that pass through it are not broken
+ */
+bool HashOpen_delete(Hash *this, const HashKey *key) {
+  HashOpenTable *table = &(this->open);
+  size_t compared = 0;
+  HashNode **slot = HashOpen_find(this, key, &compared);
+  Hash_countLookup(this, slot != NULL, compared);
+  if (slot == NULL) return false;
+  size_t index = (size_t)(slot - table->slots);
+  Hash_unlinkNode(this, *slot);
+  HashNode_free(slot, this);
+  HashOpen_setCtrl(table, index, HASH_CTRL_DELETED);
+  table->used -= 1;
+  // Shrink when less than 1/8 of the slots are used
+  size_t size = table->size;
+  if (size > this->minSize && table->used < size / 8) {
+    size_t newSize = Hash_tableSize(table->used + table->used / 7);
+    if (newSize < this->minSize) newSize = this->minSize;
+    if (newSize < HASH_GROUP_WIDTH) newSize = HASH_GROUP_WIDTH;
+    HashOpen_rehash(this, newSize);
+  }
+  return true;
+}
+
+/**
+ * Deletes all nodes and marks all the slots as empty
+ */
+void HashOpen_purge(Hash *this) {
+  HashOpenTable *table = &(this->open);
+  if (this->arena != NULL && this->external == 0) {
+    // All the nodes are released with the arena chunks
+    HashArena_release(this->arena, Hash_wipes(this));
+  } else {
+    for (size_t i = 0; i < table->size; i++) {
+      if (table->ctrl[i] >= 0) HashNode_free(&(table->slots[i]), this);
+    }
+  }
+  HashOpen_clear(this);
+}
+
+/**
+ * Marks all the slots as empty, the nodes must be already freed
+ */
+void HashOpen_clear(Hash *this) {
+  HashOpenTable *table = &(this->open);
+  memset(table->ctrl, HASH_CTRL_EMPTY, table->size + HASH_GROUP_WIDTH);
+  table->used = 0;
+  table->growthLeft = HashOpen_maxUsed(table->size);
+}
+
+/**
+ * Releases the memory used by the table, the nodes must be purged first
+ */
+void HashOpen_free(Hash *this) {
+  HashAllocator_free(&(this->allocator), this->open.ctrl);
+  HashAllocator_free(&(this->allocator), this->open.slots);
+  memset(&(this->open), 0, sizeof(HashOpenTable));
+}
+
+/**
+ * Gets the node in the first used slot
+ */
+HashNode *HashOpen_first(const Hash *this) {
+  const HashOpenTable *table = &(this->open);
+  for (size_t i = 0; i < table->size; i++) {
+    if (table->ctrl[i] >= 0) return table->slots[i];
+  }
+  return NULL;
+}
+
+/**
+ * Gets the node in the first used slot from the given index,
+ * and moves the index past it
+ */
+HashNode *HashOpen_next(const Hash *this, size_t *index) {
+  const HashOpenTable *table = &(this->open);
+  while (*index < table->size) {
+    size_t i = (*index)++;
+    if (table->ctrl[i] >= 0) return table->slots[i];
+  }
+  return NULL;
+}
+
+/**
+ * Gets the node in the last used slot
+ */
+HashNode *HashOpen_last(const Hash *this) {
+  const HashOpenTable *table = &(this->open);
+  for (size_t i = table->size; i > 0; i--) {
+    if (table->ctrl[i - 1] >= 0) return table->slots[i - 1];
+  }
+  return NULL;
+}
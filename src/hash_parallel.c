@@ -0,0 +1,287 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * Smaller hashes are built and freed by a single thread,
+ * because starting the threads would take longer
+ */
+#ifndef HASH_PARALLEL_MIN
+#define HASH_PARALLEL_MIN 16384
+#endif
+
+/**
+ * Maximum number of threads
+ */
+#define HASH_PARALLEL_MAX 256
+
+/**
+ * Work of a single thread of Hash_buildParallel()
+ * The input is split in slices, one per thread, and the table is split
+ * in partitions of consecutive buckets, one per thread
+ */
+typedef struct {
+  Hash *hash; ///< Hash being built
+  unsigned index; ///< Number of the slice and of the partition
+  unsigned threads; ///< Number of slices and partitions
+  size_t bucketsPerPart; ///< Number of buckets of each partition
+  const char *const *keys; ///< Input keys
+  const void *const *values; ///< Input values
+  const size_t *lengths; ///< Input value lengths
+  size_t count; ///< Number of input items
+  HashKey *hashKeys; ///< Hashed keys, one for each input item
+  size_t *order; ///< Input items grouped by partition, in input order
+  size_t *counts; ///< counts[slice * threads + part]: items of the slice for the partition
+  size_t *offsets; ///< Position in order of the items of the slice for each partition
+  size_t start; ///< Position in order of the first item of the partition
+  size_t end; ///< Position in order after the last item of the partition
+  size_t used; ///< Nodes added to the partition
+  bool failed; ///< A node could not be allocated
+} HashBuildTask;
+
+/**
+ * Work of a single thread of Hash_purge()
+ */
+typedef struct {
+  Hash *hash; ///< Hash being purged
+  unsigned index; ///< Number of the thread
+  unsigned threads; ///< Number of threads
+} HashPurgeTask;
+
+/**
+ * Runs the given function on the tasks, the first one on the calling thread
+ * Tasks whose thread can't be started run on the calling thread too
+ */
+static void Hash_runParallel(void *(*work)(void *), void *tasks, size_t taskSize, unsigned threads) {
+  pthread_t workers[HASH_PARALLEL_MAX];
+  bool started[HASH_PARALLEL_MAX] = {false};
+  unsigned char *task = (unsigned char *)tasks;
+  for (unsigned i = 1; i < threads; i++) {
+    started[i] = (pthread_create(&(workers[i]), NULL, work, task + i * taskSize) == 0);
+  }
+  work(task);
+  for (unsigned i = 1; i < threads; i++) {
+    if (started[i]) {
+      pthread_join(workers[i], NULL);
+    } else {
+      work(task + i * taskSize);
+    }
+  }
+}
+
+/**
+ * Returns the range [start, end) of the items of the given part
+ */
+static void Hash_split(size_t count, unsigned parts, unsigned index, size_t *start, size_t *end) {
+  size_t size = count / parts;
+  size_t rest = count % parts;
+  *start = index * size + ((index < rest) ? index : rest);
+  *end = *start + size + ((index < rest) ? 1 : 0);
+}
+
+static inline unsigned HashBuildTask_part(const HashBuildTask *this, uint64_t hash) {
+  return (unsigned)(Hash_indexFor(hash, this->hash->table[0].size) / this->bucketsPerPart);
+}
+
+/**
+ * Hashes the keys of a slice and counts the items for each partition
+ */
+static void *HashBuildTask_hash(void *argument) {
+  HashBuildTask *this = (HashBuildTask *)argument;
+  size_t start, end;
+  Hash_split(this->count, this->threads, this->index, &start, &end);
+  size_t *counts = this->counts + (size_t)this->index * this->threads;
+  for (size_t i = start; i < end; i++) {
+    this->hashKeys[i] = Hash_keyFor(this->hash, this->keys[i], strlen(this->keys[i]));
+    counts[HashBuildTask_part(this, this->hashKeys[i].hash)] += 1;
+  }
+  return NULL;
+}
+
+/**
+ * Puts the items of a slice in the lists of their partitions
+ */
+static void *HashBuildTask_scatter(void *argument) {
+  HashBuildTask *this = (HashBuildTask *)argument;
+  size_t start, end;
+  Hash_split(this->count, this->threads, this->index, &start, &end);
+  for (size_t i = start; i < end; i++) {
+    this->order[this->offsets[HashBuildTask_part(this, this->hashKeys[i].hash)]++] = i;
+  }
+  return NULL;
+}
+
+/**
+ * Adds the items of a partition to its buckets
+ * No other thread touches these buckets, so no lock is needed
+ */
+static void *HashBuildTask_link(void *argument) {
+  HashBuildTask *this = (HashBuildTask *)argument;
+  Hash *hash = this->hash;
+  HashTable *table = &(hash->table[0]);
+  for (size_t i = this->start; i < this->end; i++) {
+    size_t item = this->order[i];
+    const HashKey *key = &(this->hashKeys[item]);
+    HashNode **link = &(table->buckets[Hash_indexFor(key->hash, table->size)]);
+    while (*link != NULL && !HashNode_matches(*link, key)) link = &((*link)->next);
+    if (*link != NULL) {
+      // Later items replace the earlier ones with the same key
+      if (!HashNode_update(*link, hash, this->values[item], this->lengths[item])) this->failed = true;
+    } else {
+      *link = HashNode_new(hash, key, this->values[item], this->lengths[item]);
+      if (*link == NULL) {
+        this->failed = true;
+      } else {
+        this->used += 1;
+      }
+    }
+    if (this->failed) break;
+  }
+  return NULL;
+}
+
+/**
+ * Builds a Hash from the given items using many threads
+ */
+Hash *Hash_buildParallel(const HashOptions *options, const char *const *keys, const void *const *values, const size_t *lengths, size_t count, unsigned threads) {
+  HashOptions buildOptions = {0};
+  if (options != NULL) buildOptions = *options;
+  if (buildOptions.capacity < count) buildOptions.capacity = count;
+  Hash *this = Hash_newWith(&buildOptions);
+  if (this == NULL) return NULL;
+  if (threads > HASH_PARALLEL_MAX) threads = HASH_PARALLEL_MAX;
+  // The open addressing probes cross the partitions, and the arena,
+  // the insertion order and the sorted index are shared by all the items
+  bool serial = (threads < 2 || count < HASH_PARALLEL_MIN || this->backend == HASH_OPEN
+    || this->arena != NULL || this->entries != NULL || this->sorted != NULL);
+  if (serial) {
+    if (Hash_setMany(this, keys, values, lengths, count) != count) Hash_free(&this);
+    return this;
+  }
+
+  HashBuildTask *tasks = (HashBuildTask *)calloc(threads, sizeof(HashBuildTask));
+  HashKey *hashKeys = (HashKey *)malloc(count * sizeof(HashKey));
+  size_t *order = (size_t *)malloc(count * sizeof(size_t));
+  size_t *counts = (size_t *)calloc((size_t)threads * threads, sizeof(size_t));
+  size_t *offsets = (size_t *)calloc((size_t)threads * threads, sizeof(size_t));
+  bool failed = (tasks == NULL || hashKeys == NULL || order == NULL || counts == NULL || offsets == NULL);
+  if (!failed) {
+    size_t size = this->table[0].size;
+    for (unsigned t = 0; t < threads; t++) {
+      tasks[t] = (HashBuildTask){
+        .hash = this, .index = t, .threads = threads,
+        .bucketsPerPart = (size + threads - 1) / threads,
+        .keys = keys, .values = values, .lengths = lengths, .count = count,
+        .hashKeys = hashKeys, .order = order, .counts = counts,
+        .offsets = offsets + (size_t)t * threads
+      };
+    }
+    Hash_runParallel(HashBuildTask_hash, tasks, sizeof(HashBuildTask), threads);
+    // Partition by partition, the items of each slice follow the ones of the
+    // previous slices, so each partition keeps the input order
+    size_t position = 0;
+    for (unsigned part = 0; part < threads; part++) {
+      tasks[part].start = position;
+      for (unsigned slice = 0; slice < threads; slice++) {
+        offsets[(size_t)slice * threads + part] = position;
+        position += counts[(size_t)slice * threads + part];
+      }
+      tasks[part].end = position;
+    }
+    Hash_runParallel(HashBuildTask_scatter, tasks, sizeof(HashBuildTask), threads);
+    Hash_runParallel(HashBuildTask_link, tasks, sizeof(HashBuildTask), threads);
+    // Stitch the partitions together
+    for (unsigned t = 0; t < threads; t++) {
+      this->table[0].used += tasks[t].used;
+      this->length += (int)tasks[t].used;
+      if (tasks[t].failed) failed = true;
+    }
+  }
+  free(tasks);
+  free(hashKeys);
+  free(order);
+  free(counts);
+  free(offsets);
+  if (failed) Hash_free(&this);
+  return this;
+}
+
+/**
+ * Frees the nodes of a range of buckets or slots
+ */
+static void *HashPurgeTask_run(void *argument) {
+  HashPurgeTask *this = (HashPurgeTask *)argument;
+  Hash *hash = this->hash;
+  size_t start, end;
+  if (hash->backend == HASH_OPEN) {
+    Hash_split(hash->open.size, this->threads, this->index, &start, &end);
+    for (size_t i = start; i < end; i++) {
+      if (hash->open.ctrl[i] >= 0) HashNode_free(&(hash->open.slots[i]), hash);
+    }
+    return NULL;
+  }
+  for (int t = 0; t < 2; t++) {
+    HashTable *table = &(hash->table[t]);
+    Hash_split(table->size, this->threads, this->index, &start, &end);
+    for (size_t i = start; i < end; i++) {
+      HashNode *current = table->buckets[i];
+      while (current != NULL) {
+        HashNode *next = current->next;
+        HashNode_free(&current, hash);
+        current = next;
+      }
+      table->buckets[i] = NULL;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Frees the nodes of a big Hash on the threads set in its options
+ * Returns false, and frees nothing, when the nodes must be freed serially:
+ * small hashes, arenas, and items with destructors that could not be
+ * thread-safe
+ */
+bool Hash_purgeParallel(Hash *this) {
+  unsigned threads = (this->threads > HASH_PARALLEL_MAX) ? HASH_PARALLEL_MAX : this->threads;
+  if (threads < 2 || this->length < HASH_PARALLEL_MIN || this->arena != NULL || this->external > 0) return false;
+  HashPurgeTask tasks[HASH_PARALLEL_MAX];
+  for (unsigned t = 0; t < threads; t++) {
+    tasks[t] = (HashPurgeTask){.hash = this, .index = t, .threads = threads};
+  }
+  Hash_runParallel(HashPurgeTask_run, tasks, sizeof(HashPurgeTask), threads);
+  if (this->backend == HASH_OPEN) {
+    HashOpen_clear(this);
+  } else {
+    this->table[0].used = 0;
+    this->table[1].used = 0;
+  }
+  return true;
+}
@@ -0,0 +1,370 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef HASH_PRIVATE_H
+#define HASH_PRIVATE_H
+
+  /**
+   * Internal data structures and functions shared by the
+   * source files of the library, not part of the public API
+   */
+
+  #include <stdint.h>
+  #include <stdatomic.h>
+
+  #include "hash.h"
+
+  #ifndef HASH_SIZE
+  #define HASH_SIZE 128
+  #endif
+
+  /**
+   * Set HASH_WIPE to 0 to never wipe the memory that is freed,
+   * regardless of the options of each Hash
+   */
+  #ifndef HASH_WIPE
+  #define HASH_WIPE 1
+  #endif
+
+  /**
+   * Set HASH_STATS to 0 to compile out the lookup counters,
+   * regardless of the options of each Hash
+   */
+  #ifndef HASH_STATS
+  #define HASH_STATS 1
+  #endif
+
+  /**
+   * How the value of a node is stored
+   */
+  typedef enum {
+    HASH_VALUE_COPY, ///< Copy allocated by the Hash
+    HASH_VALUE_OWNED, ///< Buffer allocated by the caller, freed by the Hash
+    HASH_VALUE_BORROWED ///< Memory that belongs to the caller
+  } HashValueKind;
+
+  /**
+   * A HashNode is a generic struct node, with a pointer to
+   * a Tuple structure and a pointer to the next HashNode
+   * in the list.
+   */
+  typedef struct _Node HashNode;
+  typedef struct _Node {
+    HashNode *next; ///< Pointer to the next item in the list
+    uint64_t hash; ///< Full hash of the key, used to skip key comparisons and to rehash
+    size_t capacity; ///< Allocated size for the value, at least data.length
+    HashValueKind kind; ///< How the value is stored
+    HashDestructor destroy; ///< Called when a borrowed value is released, can be NULL
+    size_t entry; ///< Position in the entries of an ordered Hash
+    HashNode **forward; ///< Links of the sorted index, NULL if the Hash is not sorted
+    unsigned levels; ///< Number of links of the sorted index
+    Tuple data; ///< Structure that contains the data for the HashNode
+  } HashNode;
+
+  /**
+   * A HashKey is a key that is going to be looked up,
+   * it's measured and hashed once for each operation
+   */
+  typedef struct {
+    const char *data; ///< Key bytes
+    size_t length; ///< Length of the key, without the NULL terminator
+    uint64_t hash; ///< Full hash of the key
+  } HashKey;
+
+  /**
+   * A HashTable is an array of buckets, each bucket contains
+   * a list of HashNodes. The size is always a power of two.
+   */
+  typedef struct {
+    HashNode **buckets; ///< Bucket array, each item contains a pointer to a HashNode
+    size_t size; ///< Number of buckets
+    size_t used; ///< Number of nodes stored in this table
+  } HashTable;
+
+  /**
+   * An open addressing table, in the style of Swiss tables
+   * Each slot has a control byte: the control bytes are probed
+   * in groups of HASH_GROUP_WIDTH, and a slot is only visited when
+   * its control byte matches the lowest 7 bits of the key hash.
+   * The control array has HASH_GROUP_WIDTH extra bytes that mirror
+   * the first group, so that a group can be loaded from any position.
+   */
+  typedef struct {
+    int8_t *ctrl; ///< Control bytes, size + HASH_GROUP_WIDTH items
+    HashNode **slots; ///< Slot array, each item contains a pointer to a HashNode
+    size_t size; ///< Number of slots, always a power of two
+    size_t used; ///< Number of nodes stored in this table
+    size_t growthLeft; ///< Number of empty slots that can be filled before growing
+  } HashOpenTable;
+
+  /**
+   * Maximum number of levels of the sorted index
+   */
+  #define HASH_SKIP_LEVELS 32
+
+  /**
+   * The sorted index is a skip list of the nodes, in key order
+   * Each node has a tower of 1 to HASH_SKIP_LEVELS links, and each level
+   * skips about 3 out of 4 nodes of the level below
+   */
+  typedef struct {
+    HashNode *head[HASH_SKIP_LEVELS]; ///< First node of each level
+    unsigned levels; ///< Number of levels in use
+    uint64_t random; ///< State of the generator for the tower heights
+  } HashSkipList;
+
+  /**
+   * A read-only snapshot mapped in memory, see hash_mapped.c
+   */
+  typedef struct _HashMapped HashMapped;
+
+  /**
+   * Lookup counters of a Hash created with the stats option
+   * Lookups on the same Hash can run on many threads, for instance
+   * in a ConcurrentHash stripe, so the counters are relaxed atomics
+   */
+  typedef struct {
+    atomic_uint_fast64_t lookups; ///< Number of key searches
+    atomic_uint_fast64_t hits; ///< Searches that found the key
+    atomic_uint_fast64_t comparisons; ///< Items compared with the searched keys
+  } HashCounters;
+
+  /**
+   * Number of block size classes in an arena, class N holds 2^N bytes blocks
+   */
+  #define HASH_ARENA_CLASSES 48
+
+  typedef struct _HashChunk HashChunk;
+
+  /**
+   * An arena allocates the nodes from fixed-size slabs, and the key
+   * and value of each node from a single block. Deleted nodes and blocks
+   * are recycled through free lists, and all the memory is released
+   * at once by freeing the chunks.
+   */
+  typedef struct {
+    HashChunk *chunks; ///< All the chunks (node slabs and blocks) of the arena
+    size_t slabs; ///< Number of chunks
+    unsigned char *cursor; ///< Next free byte in the current block chunk
+    size_t remaining; ///< Bytes left in the current block chunk
+    HashNode *nodes; ///< Next free node in the current slab
+    size_t nodesLeft; ///< Nodes left in the current slab
+    HashNode *freeNodes; ///< Deleted nodes, linked through the next pointer
+    void *freeBlocks[HASH_ARENA_CLASSES]; ///< Deleted blocks for each size class
+    const HashAllocator *allocator; ///< Allocator of the Hash, used for the chunks
+  } HashArena;
+
+  /**
+   * A Hash is a sorted set of items,
+   * like a dictionary or associative array
+   *
+   * With the default HASH_CHAINED backend,
+   * the Hash uses two tables in order to rehash incrementally:
+   * while rehashing, the nodes are moved a few buckets at a time
+   * from table[0] to table[1], and when table[0] is empty the new
+   * table takes its place.
+   */
+  typedef struct _Hash {
+    HashBackend backend; ///< Storage engine used by the Hash
+    HashTable table[2]; ///< Hash tables, table[1] is used only while rehashing
+    HashOpenTable open; ///< Open addressing table, used by the HASH_OPEN backend
+    HashArena *arena; ///< Node allocator, NULL if the nodes are allocated one by one
+    size_t external; ///< Number of nodes with an owned or borrowed value
+    HashNode **entries; ///< Nodes in insertion order, NULL if the Hash is not ordered
+    size_t entriesUsed; ///< Used entries, including the ones of deleted nodes
+    size_t entriesSize; ///< Allocated entries
+    HashSkipList *sorted; ///< Index of the keys in order, NULL if the Hash is not sorted
+    HashMapped *mapped; ///< Snapshot that holds the items, NULL if the Hash is not mapped
+    HashCounters *counters; ///< Lookup counters, NULL unless the Hash has the stats option
+    HashAllocator allocator; ///< Memory functions for the tables and the items
+    HashFunction function; ///< Function used to hash the keys
+    uint64_t seed[2]; ///< Seed for the hash function
+    bool wipe; ///< Erase the memory of the items before freeing it
+    unsigned threads; ///< Threads used to free the nodes of big hashes
+    long rehashIndex; ///< Next bucket of table[0] to rehash, -1 if not rehashing
+    size_t minSize; ///< The hash table never shrinks below this size
+    int length; ///< Total length of the Hash
+  } Hash;
+
+  /**
+   * Number of control bytes probed at once by the open addressing backend
+   */
+  #define HASH_GROUP_WIDTH 16
+
+  /**
+   * Returns the smallest power of two greater or equal to the given size
+   */
+  size_t Hash_tableSize(size_t size);
+
+  /**
+   * Tells if the memory of the given Hash must be wiped when freed
+   * It's always false when the library is compiled with HASH_WIPE=0
+   */
+  #define Hash_wipes(hash) (HASH_WIPE && (hash)->wipe)
+
+  /**
+   * Memory functions that go through a HashAllocator
+   * Sizes of 0 are allocated as 1 byte, and NULL pointers are not freed
+   */
+  const HashAllocator *HashAllocator_for(const HashOptions *options);
+  void *HashAllocator_alloc(const HashAllocator *this, size_t size);
+  void *HashAllocator_calloc(const HashAllocator *this, size_t count, size_t size);
+  void *HashAllocator_realloc(const HashAllocator *this, void *pointer, size_t size);
+  void HashAllocator_free(const HashAllocator *this, void *pointer);
+
+  /**
+   * Adds a lookup to the counters of the given Hash, if it has them
+   * With HASH_STATS=0 it compiles to nothing
+   */
+  #if HASH_STATS
+  #define Hash_countLookup(hash, hit, compared) \
+    do { if ((hash)->counters != NULL) HashCounters_add((hash)->counters, (hit), (compared)); } while (0)
+  #else
+  #define Hash_countLookup(hash, hit, compared) ((void)(compared))
+  #endif
+
+  /**
+   * Lookup counters, see hash_stats.c
+   */
+  HashCounters *HashCounters_new(const HashAllocator *allocator);
+  void HashCounters_add(HashCounters *this, bool hit, size_t compared);
+  void HashStats_addChain(HashStats *stats, size_t length);
+
+  /**
+   * Erases memory in a way that can't be optimised away
+   */
+  void Hash_wipe(void *data, size_t size);
+
+  /**
+   * Removes a node from the insertion order and from the sorted index
+   */
+  void Hash_unlinkNode(Hash *this, HashNode *node);
+
+  /**
+   * Hints the CPU to load the given address in the cache
+   */
+  #if defined(__GNUC__) || defined(__clang__)
+  #define Hash_prefetch(address) __builtin_prefetch(address)
+  #else
+  #define Hash_prefetch(address) ((void)(address))
+  #endif
+
+  /**
+   * Measures and hashes the given key
+   */
+  HashKey Hash_keyFor(const Hash *this, const void *key, size_t length);
+
+  /**
+   * Variants of the Hash functions for a key whose hash is already computed
+   */
+  HashNode **Hash_find(const Hash *this, const HashKey *key);
+  void Hash_prefetchBucket(const Hash *this, uint64_t hash);
+  bool Hash_setKey(Hash *this, const HashKey *key, const void *value, size_t length);
+  bool Hash_deleteKey(Hash *this, const HashKey *key);
+
+  /**
+   * Computes the bucket index for a given hash
+   */
+  size_t Hash_indexFor(uint64_t hash, size_t size);
+
+  /**
+   * Frees the nodes on many threads, see hash_parallel.c
+   */
+  bool Hash_purgeParallel(Hash *this);
+
+  /**
+   * Creates and destroys Hash nodes
+   */
+  HashNode *HashNode_new(Hash *hash, const HashKey *key, const void *value, size_t length);
+  bool HashNode_update(HashNode *this, Hash *hash, const void *value, size_t length);
+  void HashNode_releaseValue(HashNode *this, Hash *hash);
+  void HashNode_free(HashNode **this, Hash *hash);
+
+  /**
+   * Tells if the node contains the given key
+   */
+  bool HashNode_matches(const HashNode *this, const HashKey *key);
+
+  /**
+   * Adds the memory used by the node to the statistics
+   */
+  void HashNode_measure(const HashNode *this, const Hash *hash, HashStats *stats);
+
+  /**
+   * Arena allocator, see hash_arena.c
+   */
+  HashArena *HashArena_new(const HashAllocator *allocator);
+  void *HashArena_alloc(HashArena *this, size_t size);
+  void HashArena_free(HashArena *this, void *block, size_t size);
+  HashNode *HashArena_node(HashArena *this, const HashKey *key, const void *value, size_t length);
+  bool HashArena_update(HashArena *this, HashNode *node, const void *value, size_t length, bool wipe);
+  void HashArena_resetValue(HashNode *node);
+  void HashArena_freeNode(HashArena *this, HashNode *node, bool wipe);
+  void HashArena_release(HashArena *this, bool wipe);
+
+  /**
+   * Open addressing backend, see hash_open.c
+   */
+  bool HashOpen_init(Hash *this, size_t size);
+  HashNode **HashOpen_find(const Hash *this, const HashKey *key, size_t *compared);
+  size_t HashOpen_groupsFor(const Hash *this, size_t index);
+  void HashOpen_prefetch(const Hash *this, uint64_t hash);
+  bool HashOpen_reserve(Hash *this, size_t capacity);
+  bool HashOpen_insert(Hash *this, HashNode *item);
+  bool HashOpen_delete(Hash *this, const HashKey *key);
+  void HashOpen_purge(Hash *this);
+  void HashOpen_clear(Hash *this);
+  void HashOpen_free(Hash *this);
+  HashNode *HashOpen_first(const Hash *this);
+  HashNode *HashOpen_last(const Hash *this);
+  HashNode *HashOpen_next(const Hash *this, size_t *index);
+
+  /**
+   * Mapped snapshots, see hash_mapped.c
+   */
+  bool HashMapped_find(const Hash *this, const HashKey *key, Tuple *item);
+  bool HashMapped_next(const Hash *this, size_t *index, Tuple *item);
+  void HashMapped_close(Hash *this);
+  void HashMapped_stats(const Hash *this, HashStats *stats);
+
+  /**
+   * Maps a whole file in memory, read-only
+   */
+  bool Hash_mapFile(const char *path, const unsigned char **data, size_t *size, bool sequential);
+  void Hash_unmapFile(const unsigned char *data, size_t size);
+
+  /**
+   * Sorted index, see hash_sorted.c
+   */
+  bool HashSkip_init(Hash *this);
+  bool HashSkip_prepare(Hash *this, HashNode *node);
+  void HashSkip_insert(Hash *this, HashNode *node);
+  void HashSkip_remove(Hash *this, HashNode *node);
+  void HashSkip_freeTower(Hash *this, HashNode *node);
+  void HashSkip_purge(Hash *this);
+  void HashSkip_free(Hash *this);
+  HashNode *HashSkip_first(const Hash *this);
+  HashNode *HashSkip_last(const Hash *this);
+  const Tuple *HashSkip_next(HashIter *iter);
+#endif
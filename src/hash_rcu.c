@@ -0,0 +1,512 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * Maximum number of threads that can be registered as readers at
+ * the same time; more readers still work, but they delay the reclamation
+ * of the memory until all of them are done
+ */
+#ifndef HASH_RCU_THREADS
+#define HASH_RCU_THREADS 256
+#endif
+
+#define HASH_CACHE_LINE 64
+
+/**
+ * Nodes are never changed after they are published: an update replaces
+ * the whole node, so a reader always sees a consistent key and value
+ * The key and the value are stored in the same allocation as the node
+ */
+typedef struct _RcuNode RcuNode;
+struct _RcuNode {
+  _Atomic(RcuNode *) next; ///< Next node in the bucket
+  RcuNode *retired; ///< Next node in the list of retired nodes
+  uint64_t epoch; ///< Epoch when the node was retired
+  uint64_t hash; ///< Hash of the key
+  size_t keyLength; ///< Length of the key
+  size_t length; ///< Length of the value
+  char *value; ///< The value, after the key and aligned to 8 bytes
+  char key[]; ///< The key, terminated by a NUL byte
+};
+
+typedef struct _RcuTable RcuTable;
+struct _RcuTable {
+  RcuTable *retired; ///< Next table in the list of retired tables
+  uint64_t epoch; ///< Epoch when the table was retired
+  size_t size; ///< Number of buckets, a power of two
+  _Atomic(RcuNode *) buckets[]; ///< Heads of the bucket lists
+};
+
+struct _RcuHash {
+  _Atomic(RcuTable *) table; ///< The current table
+  HashFunction function; ///< Function used to hash the keys
+  uint64_t seed[2]; ///< Seed for the hash function
+  bool wipe; ///< Erase the memory of the items before freeing it
+  atomic_int length; ///< Number of items
+  pthread_mutex_t lock; ///< Serializes the writers
+  RcuNode *retiredNodes; ///< Unlinked nodes that readers could still see
+  RcuTable *retiredTables; ///< Replaced tables that readers could still see
+  HashAllocator allocator; ///< Memory functions for the tables and the nodes
+};
+
+/**
+ * Epoch-based reclamation
+ *
+ * Each reader thread owns a slot, and while it's reading it publishes
+ * in the slot the global epoch it has seen. The global epoch can only
+ * advance when all the active readers have seen the current one, so
+ * anything retired two epochs ago can't be seen by any reader anymore.
+ * Readers never wait, the writers just keep the memory around longer.
+ */
+typedef struct {
+  _Alignas(HASH_CACHE_LINE) _Atomic uint64_t epoch; ///< Epoch seen by the reader, 0 if not reading
+  atomic_bool used; ///< The slot belongs to a thread
+  unsigned depth; ///< Nesting level of the reads, only used by the owner
+} RcuSlot;
+
+static RcuSlot RcuHash_slots[HASH_RCU_THREADS];
+static _Atomic uint64_t RcuHash_epoch = 1;
+// Readers that could not get a slot
+static atomic_int RcuHash_overflow = 0;
+
+static pthread_once_t RcuHash_once = PTHREAD_ONCE_INIT;
+static pthread_key_t RcuHash_key;
+static _Thread_local RcuSlot *RcuHash_slot = NULL;
+static _Thread_local unsigned RcuHash_overflowDepth = 0;
+
+/**
+ * Gives the slot back when its thread exits
+ */
+static void RcuHash_releaseSlot(void *data) {
+  RcuSlot *slot = (RcuSlot *)data;
+  atomic_store(&(slot->epoch), 0);
+  atomic_store(&(slot->used), false);
+}
+
+static void RcuHash_init() {
+  pthread_key_create(&RcuHash_key, RcuHash_releaseSlot);
+}
+
+/**
+ * Finds a free slot for the calling thread, returns NULL if none is left
+ */
+static RcuSlot *RcuHash_registerThread() {
+  pthread_once(&RcuHash_once, RcuHash_init);
+  for (size_t i = 0; i < HASH_RCU_THREADS; i++) {
+    bool expected = false;
+    RcuSlot *slot = &(RcuHash_slots[i]);
+    if (!atomic_load_explicit(&(slot->used), memory_order_relaxed)
+      && atomic_compare_exchange_strong(&(slot->used), &expected, true)) {
+      slot->depth = 0;
+      if (pthread_setspecific(RcuHash_key, slot) != 0) {
+        atomic_store(&(slot->used), false);
+        return NULL;
+      }
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Starts a read section
+ */
+void RcuHash_enter() {
+  if (RcuHash_overflowDepth == 0 && RcuHash_slot == NULL) {
+    RcuHash_slot = RcuHash_registerThread();
+  }
+  if (RcuHash_overflowDepth > 0 || RcuHash_slot == NULL) {
+    RcuHash_overflowDepth += 1;
+    if (RcuHash_overflowDepth == 1) atomic_fetch_add(&RcuHash_overflow, 1);
+    return;
+  }
+  RcuSlot *slot = RcuHash_slot;
+  if (slot->depth++ == 0) {
+    // Sequentially consistent, the epoch must be visible to the writers
+    // before any pointer is read
+    atomic_store(&(slot->epoch), atomic_load(&RcuHash_epoch));
+  }
+}
+
+/**
+ * Ends a read section
+ */
+void RcuHash_leave() {
+  if (RcuHash_overflowDepth > 0) {
+    RcuHash_overflowDepth -= 1;
+    if (RcuHash_overflowDepth == 0) atomic_fetch_sub(&RcuHash_overflow, 1);
+    return;
+  }
+  RcuSlot *slot = RcuHash_slot;
+  if (slot != NULL && --slot->depth == 0) {
+    atomic_store_explicit(&(slot->epoch), 0, memory_order_release);
+  }
+}
+
+/**
+ * Advances the global epoch if all the active readers have seen it,
+ * and returns the current epoch
+ */
+static uint64_t RcuHash_advance() {
+  uint64_t epoch = atomic_load(&RcuHash_epoch);
+  if (atomic_load(&RcuHash_overflow) > 0) return epoch;
+  for (size_t i = 0; i < HASH_RCU_THREADS; i++) {
+    uint64_t seen = atomic_load(&(RcuHash_slots[i].epoch));
+    if (seen != 0 && seen != epoch) return epoch;
+  }
+  // Another writer can advance it at the same time, that's fine
+  atomic_compare_exchange_strong(&RcuHash_epoch, &epoch, epoch + 1);
+  return atomic_load(&RcuHash_epoch);
+}
+
+/**
+ * Rounds the key size up, so that the value that follows is aligned
+ */
+static size_t RcuNode_keySize(size_t keyLength) {
+  return (keyLength + 1 + 7) & ~(size_t)7;
+}
+
+/**
+ * Frees a node, optionally wiping its content
+ */
+static void RcuNode_free(const RcuHash *hash, RcuNode *node) {
+  if (hash->wipe) Hash_wipe(node->key, RcuNode_keySize(node->keyLength) + node->length);
+  HashAllocator_free(&(hash->allocator), node);
+}
+
+/**
+ * Creates a node with a copy of the key and the value
+ */
+static RcuNode *RcuNode_new(const RcuHash *hash, const HashKey *key, const void *value, size_t length) {
+  RcuNode *node = (RcuNode *)HashAllocator_alloc(&(hash->allocator), sizeof(RcuNode) + RcuNode_keySize(key->length) + length);
+  if (node == NULL) return NULL;
+  atomic_init(&(node->next), NULL);
+  node->retired = NULL;
+  node->epoch = 0;
+  node->hash = key->hash;
+  node->keyLength = key->length;
+  node->length = length;
+  memcpy(node->key, key->data, key->length);
+  node->key[key->length] = '\0';
+  node->value = node->key + RcuNode_keySize(key->length);
+  if (length > 0) memcpy(node->value, value, length);
+  return node;
+}
+
+/**
+ * Allocates an empty table
+ */
+static RcuTable *RcuTable_new(const RcuHash *hash, size_t size) {
+  RcuTable *table = (RcuTable *)HashAllocator_alloc(&(hash->allocator), sizeof(RcuTable) + size * sizeof(_Atomic(RcuNode *)));
+  if (table == NULL) return NULL;
+  table->retired = NULL;
+  table->epoch = 0;
+  table->size = size;
+  for (size_t i = 0; i < size; i++) atomic_init(&(table->buckets[i]), NULL);
+  return table;
+}
+
+/**
+ * Frees the retired nodes and tables that no reader can see anymore
+ * Must be called by the writer
+ */
+static void RcuHash_collect(RcuHash *this) {
+  uint64_t epoch = RcuHash_advance();
+  RcuNode **node = &(this->retiredNodes);
+  while (*node != NULL) {
+    if ((*node)->epoch + 2 <= epoch) {
+      RcuNode *expired = *node;
+      *node = expired->retired;
+      RcuNode_free(this, expired);
+    } else {
+      node = &((*node)->retired);
+    }
+  }
+  RcuTable **table = &(this->retiredTables);
+  while (*table != NULL) {
+    if ((*table)->epoch + 2 <= epoch) {
+      RcuTable *expired = *table;
+      *table = expired->retired;
+      HashAllocator_free(&(this->allocator), expired);
+    } else {
+      table = &((*table)->retired);
+    }
+  }
+}
+
+/**
+ * Puts an unlinked node on the retired list
+ */
+static void RcuHash_retire(RcuHash *this, RcuNode *node) {
+  node->epoch = atomic_load(&RcuHash_epoch);
+  node->retired = this->retiredNodes;
+  this->retiredNodes = node;
+}
+
+/**
+ * Creates a new RcuHash
+ */
+RcuHash *RcuHash_new(const HashOptions *options) {
+  const HashAllocator *allocator = HashAllocator_for(options);
+  if (allocator == NULL) return NULL;
+  RcuHash *this = (RcuHash *)HashAllocator_calloc(allocator, 1, sizeof(RcuHash));
+  if (this == NULL) return NULL;
+  this->allocator = *allocator;
+  size_t size = Hash_tableSize(HASH_SIZE);
+  this->function = HashFunction_wyhash;
+  this->wipe = !(options != NULL && options->fastFree);
+  if (options != NULL) {
+    if (options->capacity > 0) size = Hash_tableSize(options->capacity);
+    if (options->function != NULL) this->function = options->function;
+    this->seed[0] = options->seed[0];
+    this->seed[1] = options->seed[1];
+  }
+  RcuTable *table = RcuTable_new(this, size);
+  if (table == NULL || pthread_mutex_init(&(this->lock), NULL) != 0) {
+    HashAllocator_free(allocator, table);
+    HashAllocator_free(allocator, this);
+    return NULL;
+  }
+  atomic_init(&(this->table), table);
+  atomic_init(&(this->length), 0);
+  return this;
+}
+
+/**
+ * Destroys an RcuHash and all its items
+ */
+void RcuHash_free(RcuHash **this) {
+  if (this != NULL && *this != NULL) {
+    RcuHash *hash = *this;
+    RcuTable *table = atomic_load(&(hash->table));
+    for (size_t i = 0; i < table->size; i++) {
+      RcuNode *node = atomic_load_explicit(&(table->buckets[i]), memory_order_relaxed);
+      while (node != NULL) {
+        RcuNode *next = atomic_load_explicit(&(node->next), memory_order_relaxed);
+        RcuNode_free(hash, node);
+        node = next;
+      }
+    }
+    HashAllocator_free(&(hash->allocator), table);
+    while (hash->retiredNodes != NULL) {
+      RcuNode *node = hash->retiredNodes;
+      hash->retiredNodes = node->retired;
+      RcuNode_free(hash, node);
+    }
+    while (hash->retiredTables != NULL) {
+      RcuTable *retired = hash->retiredTables;
+      hash->retiredTables = retired->retired;
+      HashAllocator_free(&(hash->allocator), retired);
+    }
+    pthread_mutex_destroy(&(hash->lock));
+    HashAllocator allocator = hash->allocator;
+    HashAllocator_free(&allocator, hash);
+    *this = NULL;
+  }
+}
+
+/**
+ * Returns the number of items
+ */
+int RcuHash_length(const RcuHash *this) {
+  return atomic_load_explicit(&(this->length), memory_order_relaxed);
+}
+
+/**
+ * Finds the link to the node with the given key
+ * Must be called by the writer
+ */
+static _Atomic(RcuNode *) *RcuHash_findLink(RcuTable *table, const HashKey *key) {
+  _Atomic(RcuNode *) *link = &(table->buckets[key->hash & (table->size - 1)]);
+  RcuNode *node;
+  while ((node = atomic_load_explicit(link, memory_order_relaxed)) != NULL) {
+    if (node->hash == key->hash && node->keyLength == key->length
+      && memcmp(node->key, key->data, key->length) == 0) {
+      return link;
+    }
+    link = &(node->next);
+  }
+  return NULL;
+}
+
+/**
+ * Publishes a copy of the table with twice the buckets
+ * The nodes are cloned, because the readers of the old table
+ * still follow their links
+ */
+static bool RcuHash_grow(RcuHash *this) {
+  RcuTable *old = atomic_load_explicit(&(this->table), memory_order_relaxed);
+  RcuTable *table = RcuTable_new(this, old->size * 2);
+  if (table == NULL) return false;
+  for (size_t i = 0; i < old->size; i++) {
+    RcuNode *node = atomic_load_explicit(&(old->buckets[i]), memory_order_relaxed);
+    while (node != NULL) {
+      HashKey key = {.data = node->key, .length = node->keyLength, .hash = node->hash};
+      RcuNode *clone = RcuNode_new(this, &key, node->value, node->length);
+      if (clone == NULL) {
+        // The new table was never published
+        for (size_t j = 0; j < table->size; j++) {
+          RcuNode *item = atomic_load_explicit(&(table->buckets[j]), memory_order_relaxed);
+          while (item != NULL) {
+            RcuNode *next = atomic_load_explicit(&(item->next), memory_order_relaxed);
+            RcuNode_free(this, item);
+            item = next;
+          }
+        }
+        HashAllocator_free(&(this->allocator), table);
+        return false;
+      }
+      _Atomic(RcuNode *) *bucket = &(table->buckets[node->hash & (table->size - 1)]);
+      atomic_init(&(clone->next), atomic_load_explicit(bucket, memory_order_relaxed));
+      atomic_init(bucket, clone);
+      node = atomic_load_explicit(&(node->next), memory_order_relaxed);
+    }
+  }
+  atomic_store_explicit(&(this->table), table, memory_order_release);
+  // Retire the old table and all its nodes
+  for (size_t i = 0; i < old->size; i++) {
+    RcuNode *node = atomic_load_explicit(&(old->buckets[i]), memory_order_relaxed);
+    while (node != NULL) {
+      RcuHash_retire(this, node);
+      node = atomic_load_explicit(&(node->next), memory_order_relaxed);
+    }
+  }
+  old->epoch = atomic_load(&RcuHash_epoch);
+  old->retired = this->retiredTables;
+  this->retiredTables = old;
+  return true;
+}
+
+/**
+ * Sets a key-value pair, replacing the node if the key exists
+ */
+bool RcuHash_set(RcuHash *this, const char *key, const void *value, size_t length) {
+  HashKey hashKey = {.data = key, .length = strlen(key)};
+  hashKey.hash = this->function(key, hashKey.length, this->seed);
+  RcuNode *node = RcuNode_new(this, &hashKey, value, length);
+  if (node == NULL) return false;
+  pthread_mutex_lock(&(this->lock));
+  RcuTable *table = atomic_load_explicit(&(this->table), memory_order_relaxed);
+  _Atomic(RcuNode *) *link = RcuHash_findLink(table, &hashKey);
+  if (link != NULL) {
+    RcuNode *old = atomic_load_explicit(link, memory_order_relaxed);
+    atomic_init(&(node->next), atomic_load_explicit(&(old->next), memory_order_relaxed));
+    // The node is complete before it's visible
+    atomic_store_explicit(link, node, memory_order_release);
+    RcuHash_retire(this, old);
+  } else {
+    if ((size_t)atomic_load_explicit(&(this->length), memory_order_relaxed) >= table->size) {
+      // If the table can't grow the chains just get longer
+      if (RcuHash_grow(this)) table = atomic_load_explicit(&(this->table), memory_order_relaxed);
+    }
+    _Atomic(RcuNode *) *bucket = &(table->buckets[hashKey.hash & (table->size - 1)]);
+    atomic_init(&(node->next), atomic_load_explicit(bucket, memory_order_relaxed));
+    atomic_store_explicit(bucket, node, memory_order_release);
+    atomic_fetch_add_explicit(&(this->length), 1, memory_order_relaxed);
+  }
+  RcuHash_collect(this);
+  pthread_mutex_unlock(&(this->lock));
+  return true;
+}
+
+/**
+ * Deletes the item for the given key
+ */
+bool RcuHash_delete(RcuHash *this, const char *key) {
+  HashKey hashKey = {.data = key, .length = strlen(key)};
+  hashKey.hash = this->function(key, hashKey.length, this->seed);
+  pthread_mutex_lock(&(this->lock));
+  RcuTable *table = atomic_load_explicit(&(this->table), memory_order_relaxed);
+  _Atomic(RcuNode *) *link = RcuHash_findLink(table, &hashKey);
+  if (link != NULL) {
+    RcuNode *old = atomic_load_explicit(link, memory_order_relaxed);
+    // Readers that are on the old node can still move past it
+    atomic_store_explicit(link, atomic_load_explicit(&(old->next), memory_order_relaxed), memory_order_release);
+    RcuHash_retire(this, old);
+    atomic_fetch_sub_explicit(&(this->length), 1, memory_order_relaxed);
+  }
+  RcuHash_collect(this);
+  pthread_mutex_unlock(&(this->lock));
+  return (link != NULL);
+}
+
+/**
+ * Finds the node for the given key without taking any lock
+ */
+static const RcuNode *RcuHash_find(const RcuHash *this, const char *key) {
+  HashKey hashKey = {.data = key, .length = strlen(key)};
+  hashKey.hash = this->function(key, hashKey.length, this->seed);
+  RcuTable *table = atomic_load_explicit(&(this->table), memory_order_acquire);
+  RcuNode *node = atomic_load_explicit(&(table->buckets[hashKey.hash & (table->size - 1)]), memory_order_acquire);
+  while (node != NULL) {
+    if (node->hash == hashKey.hash && node->keyLength == hashKey.length
+      && memcmp(node->key, key, hashKey.length) == 0) {
+      return node;
+    }
+    node = atomic_load_explicit(&(node->next), memory_order_acquire);
+  }
+  return NULL;
+}
+
+/**
+ * Gets the value for the given key, must be called in a read section
+ */
+const void *RcuHash_getValue(const RcuHash *this, const char *key, size_t *length) {
+  const RcuNode *node = RcuHash_find(this, key);
+  if (node == NULL) return NULL;
+  if (length != NULL) *length = node->length;
+  return node->value;
+}
+
+/**
+ * Copies the value for the given key into the given buffer
+ */
+bool RcuHash_getInto(const RcuHash *this, const char *key, void *buffer, size_t size, size_t *length) {
+  RcuHash_enter();
+  const RcuNode *node = RcuHash_find(this, key);
+  if (node != NULL) {
+    memcpy(buffer, node->value, (node->length < size) ? node->length : size);
+    if (length != NULL) *length = node->length;
+  }
+  RcuHash_leave();
+  return (node != NULL);
+}
+
+/**
+ * Tells if the given key exists
+ */
+bool RcuHash_has(const RcuHash *this, const char *key) {
+  RcuHash_enter();
+  bool result = (RcuHash_find(this, key) != NULL);
+  RcuHash_leave();
+  return result;
+}
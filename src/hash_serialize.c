@@ -0,0 +1,303 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * A serialized Hash is a stream of:
+ * - the header: magic, version and number of items
+ * - the chunks: a header with the number of items and the size of
+ *   the records, followed by the records
+ * - an empty chunk header that marks the end of the stream
+ * A record is the key length and the value length as varints,
+ * then the key and the value
+ * The numbers of the headers are 64 bit little endian, so the stream
+ * can be read on any machine
+ */
+#define HASH_STREAM_MAGIC "vHashSer"
+#define HASH_STREAM_VERSION 1
+
+/**
+ * Size of the records of a chunk, a chunk is bigger only if it
+ * contains a single big item
+ */
+#ifndef HASH_CHUNK_SIZE
+#define HASH_CHUNK_SIZE (1 << 20)
+#endif
+
+/**
+ * Chunks bigger than this are considered corrupted
+ */
+#define HASH_CHUNK_MAX ((uint64_t)1 << 32)
+
+/**
+ * Items between the prefetch of a bucket and the insertion of the item
+ */
+#define HASH_LINK_DISTANCE 8
+
+/**
+ * A chunk read from the stream, with its items once parsed
+ */
+typedef struct {
+  unsigned char *data; ///< Records
+  uint64_t size; ///< Size of the records
+  uint64_t count; ///< Number of records
+  Tuple *items; ///< Parsed records, pointing into data
+  uint64_t *hashes; ///< Hashes of the keys
+  bool valid; ///< The records were parsed successfully
+  const Hash *hash; ///< Hash that provides the hash function
+} HashStreamChunk;
+
+static void Hash_encode64(unsigned char *buffer, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    buffer[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+static uint64_t Hash_decode64(const unsigned char *buffer) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= (uint64_t)buffer[i] << (8 * i);
+  }
+  return value;
+}
+
+/**
+ * Writes a LEB128 varint, returns the number of bytes
+ */
+static size_t Hash_encodeVarint(unsigned char *buffer, uint64_t value) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    buffer[size++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  buffer[size++] = (unsigned char)value;
+  return size;
+}
+
+/**
+ * Reads a LEB128 varint, returns false if it doesn't end before the limit
+ */
+static bool Hash_decodeVarint(const unsigned char **cursor, const unsigned char *end, uint64_t *value) {
+  *value = 0;
+  for (unsigned shift = 0; shift < 64 && *cursor < end; shift += 7) {
+    unsigned char byte = *((*cursor)++);
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+/**
+ * Writes a chunk header and the records
+ */
+static bool Hash_writeChunk(HashWriter write, void *context, const unsigned char *data, uint64_t size, uint64_t count) {
+  unsigned char header[16];
+  Hash_encode64(header, count);
+  Hash_encode64(header + 8, size);
+  if (!write(header, sizeof(header), context)) return false;
+  return size == 0 || write(data, size, context);
+}
+
+/**
+ * Writes the items in table order, in chunks of about HASH_CHUNK_SIZE bytes
+ * The records are encoded in a single buffer, reused for all the chunks
+ */
+bool Hash_serialize(const Hash *this, HashWriter write, void *context) {
+  unsigned char header[24];
+  memcpy(header, HASH_STREAM_MAGIC, 8);
+  Hash_encode64(header + 8, HASH_STREAM_VERSION);
+  Hash_encode64(header + 16, (uint64_t)this->length);
+  if (!write(header, sizeof(header), context)) return false;
+
+  size_t capacity = HASH_CHUNK_SIZE;
+  unsigned char *buffer = (unsigned char *)malloc(capacity);
+  if (buffer == NULL) return false;
+  size_t used = 0;
+  uint64_t count = 0;
+  bool result = true;
+  HashIter iter;
+  HashIter_init(&iter, this);
+  const Tuple *item;
+  while (result && (item = HashIter_next(&iter)) != NULL) {
+    // Two varints take at most 20 bytes
+    size_t size = 20 + item->keyLength + item->length;
+    if (used + size > capacity && count > 0) {
+      result = Hash_writeChunk(write, context, buffer, used, count);
+      used = 0;
+      count = 0;
+    }
+    if (result && size > capacity) {
+      unsigned char *bigger = (unsigned char *)realloc(buffer, size);
+      if (bigger == NULL) {
+        result = false;
+        break;
+      }
+      buffer = bigger;
+      capacity = size;
+    }
+    if (!result) break;
+    used += Hash_encodeVarint(buffer + used, item->keyLength);
+    used += Hash_encodeVarint(buffer + used, item->length);
+    memcpy(buffer + used, item->key, item->keyLength);
+    used += item->keyLength;
+    if (item->length > 0) memcpy(buffer + used, item->value, item->length);
+    used += item->length;
+    count++;
+  }
+  if (result && count > 0) result = Hash_writeChunk(write, context, buffer, used, count);
+  if (result) result = Hash_writeChunk(write, context, NULL, 0, 0);
+  if (Hash_wipes(this)) Hash_wipe(buffer, capacity);
+  free(buffer);
+  return result;
+}
+
+/**
+ * Splits the records of a chunk and hashes their keys
+ * The chunk is valid only if the records fill it exactly
+ */
+static void *HashStreamChunk_parse(void *argument) {
+  HashStreamChunk *chunk = (HashStreamChunk *)argument;
+  const unsigned char *cursor = chunk->data;
+  const unsigned char *end = chunk->data + chunk->size;
+  chunk->valid = false;
+  for (uint64_t i = 0; i < chunk->count; i++) {
+    uint64_t keyLength, length;
+    if (!Hash_decodeVarint(&cursor, end, &keyLength)) return NULL;
+    if (!Hash_decodeVarint(&cursor, end, &length)) return NULL;
+    if (keyLength > (uint64_t)(end - cursor) || length > (uint64_t)(end - cursor) - keyLength) return NULL;
+    Tuple *item = &(chunk->items[i]);
+    item->key = (char *)cursor;
+    item->keyLength = keyLength;
+    item->value = (void *)(cursor + keyLength);
+    item->length = length;
+    chunk->hashes[i] = Hash_keyFor(chunk->hash, cursor, keyLength).hash;
+    cursor += keyLength + length;
+  }
+  chunk->valid = (cursor == end);
+  return NULL;
+}
+
+/**
+ * Reads the next chunk, sets its count to 0 at the end of the stream
+ */
+static bool HashStreamChunk_read(HashStreamChunk *chunk, const Hash *hash, HashReader read, void *context) {
+  unsigned char header[16];
+  if (!read(header, sizeof(header), context)) return false;
+  chunk->count = Hash_decode64(header);
+  chunk->size = Hash_decode64(header + 8);
+  chunk->hash = hash;
+  if (chunk->count == 0) return chunk->size == 0;
+  // Each record takes at least 2 bytes
+  if (chunk->size > HASH_CHUNK_MAX || chunk->count > chunk->size / 2) return false;
+  chunk->data = (unsigned char *)malloc(chunk->size);
+  chunk->items = (Tuple *)malloc(chunk->count * sizeof(Tuple));
+  chunk->hashes = (uint64_t *)malloc(chunk->count * sizeof(uint64_t));
+  if (chunk->data == NULL || chunk->items == NULL || chunk->hashes == NULL) return false;
+  return read(chunk->data, chunk->size, context);
+}
+
+static void HashStreamChunk_release(HashStreamChunk *chunk, bool wipe) {
+  if (chunk->data != NULL && wipe) Hash_wipe(chunk->data, chunk->size);
+  free(chunk->data);
+  free(chunk->items);
+  free(chunk->hashes);
+  memset(chunk, 0, sizeof(HashStreamChunk));
+}
+
+/**
+ * Adds the parsed items of a chunk, in stream order
+ */
+static bool HashStreamChunk_link(const HashStreamChunk *chunk, Hash *hash) {
+  for (uint64_t i = 0; i < chunk->count; i++) {
+    if (i + HASH_LINK_DISTANCE < chunk->count) Hash_prefetchBucket(hash, chunk->hashes[i + HASH_LINK_DISTANCE]);
+    const Tuple *item = &(chunk->items[i]);
+    HashKey key = {item->key, item->keyLength, chunk->hashes[i]};
+    if (!Hash_setKey(hash, &key, item->value, item->length)) return false;
+  }
+  return true;
+}
+
+/**
+ * Reads a stream written by Hash_serialize()
+ * The table is presized for the number of items in the stream header;
+ * batches of chunks are parsed and hashed on the given number of threads,
+ * then the items are added by the calling thread in stream order
+ */
+bool Hash_deserialize(Hash *this, HashReader read, void *context, unsigned threads) {
+  if (this->mapped != NULL) return false;
+  unsigned char header[24];
+  if (!read(header, sizeof(header), context)) return false;
+  if (memcmp(header, HASH_STREAM_MAGIC, 8) != 0 || Hash_decode64(header + 8) != HASH_STREAM_VERSION) return false;
+  // The count is only a hint, a broken stream must not reserve huge tables
+  uint64_t count = Hash_decode64(header + 16);
+  if (count <= HASH_CHUNK_MAX) Hash_reserve(this, (size_t)this->length + (size_t)count);
+
+  if (threads == 0) threads = 1;
+  HashStreamChunk *chunks = (HashStreamChunk *)calloc(threads, sizeof(HashStreamChunk));
+  pthread_t *workers = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  bool *started = (bool *)calloc(threads, sizeof(bool));
+  bool result = (chunks != NULL && workers != NULL && started != NULL);
+  bool done = false;
+  bool wipe = Hash_wipes(this);
+  while (result && !done) {
+    // Read a batch of chunks, one for each thread
+    unsigned batch = 0;
+    while (batch < threads) {
+      if (!HashStreamChunk_read(&(chunks[batch]), this, read, context)) {
+        result = false;
+        HashStreamChunk_release(&(chunks[batch]), wipe);
+        break;
+      }
+      if (chunks[batch].count == 0) {
+        done = true;
+        break;
+      }
+      batch++;
+    }
+    // The first chunk of the batch is parsed by the calling thread
+    for (unsigned i = 1; result && i < batch; i++) {
+      started[i] = (pthread_create(&(workers[i]), NULL, HashStreamChunk_parse, &(chunks[i])) == 0);
+      if (!started[i]) HashStreamChunk_parse(&(chunks[i]));
+    }
+    if (result && batch > 0) HashStreamChunk_parse(&(chunks[0]));
+    for (unsigned i = 1; i < batch; i++) {
+      if (started[i]) pthread_join(workers[i], NULL);
+      started[i] = false;
+    }
+    for (unsigned i = 0; i < batch; i++) {
+      if (result) result = chunks[i].valid && HashStreamChunk_link(&(chunks[i]), this);
+      HashStreamChunk_release(&(chunks[i]), wipe);
+    }
+  }
+  free(chunks);
+  free(workers);
+  free(started);
+  return result;
+}
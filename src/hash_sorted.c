@@ -0,0 +1,235 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * Compares the key of a node with the given key, in byte order
+ * Returns a negative number, zero or a positive number when the node
+ * comes before, is equal to, or comes after the key
+ */
+static int HashSkip_compare(const HashNode *node, const char *key, size_t length) {
+  size_t common = (node->data.keyLength < length) ? node->data.keyLength : length;
+  int result = memcmp(node->data.key, key, common);
+  if (result != 0) return result;
+  return (node->data.keyLength > length) - (node->data.keyLength < length);
+}
+
+/**
+ * Finds, for each level, the link that points to the first node
+ * that is not smaller than the given key
+ * The links are either a node tower or the list head
+ */
+static void HashSkip_find(HashSkipList *list, const char *key, size_t length, HashNode ***links) {
+  HashNode **current = list->head;
+  for (unsigned level = list->levels; level > 0; level--) {
+    while (current[level - 1] != NULL && HashSkip_compare(current[level - 1], key, length) < 0) {
+      current = current[level - 1]->forward;
+    }
+    links[level - 1] = current;
+  }
+}
+
+/**
+ * Returns the first node that is not smaller than the given key
+ */
+static HashNode *HashSkip_seek(const Hash *this, const char *key, size_t length) {
+  HashNode **links[HASH_SKIP_LEVELS];
+  if (this->sorted->levels == 0) return NULL;
+  HashSkip_find(this->sorted, key, length, links);
+  return links[0][0];
+}
+
+/**
+ * Creates the empty index
+ */
+bool HashSkip_init(Hash *this) {
+  this->sorted = (HashSkipList *)HashAllocator_calloc(&(this->allocator), 1, sizeof(HashSkipList));
+  if (this->sorted == NULL) return false;
+  this->sorted->random = 0x9e3779b97f4a7c15ull;
+  return true;
+}
+
+/**
+ * Allocates the tower of links for a new node
+ * The height is random: each level has 1/4 of the nodes of the level below
+ */
+bool HashSkip_prepare(Hash *this, HashNode *node) {
+  HashSkipList *list = this->sorted;
+  // xorshift64*
+  list->random ^= list->random >> 12;
+  list->random ^= list->random << 25;
+  list->random ^= list->random >> 27;
+  uint64_t bits = list->random * 0x2545f4914f6cdd1dull;
+  unsigned levels = 1;
+  while (levels < HASH_SKIP_LEVELS && (bits & 3) == 0) {
+    levels++;
+    bits >>= 2;
+  }
+  size_t size = levels * sizeof(HashNode *);
+  node->forward = (HashNode **)((this->arena != NULL) ? HashArena_alloc(this->arena, size) : HashAllocator_alloc(&(this->allocator), size));
+  if (node->forward == NULL) return false;
+  node->levels = levels;
+  return true;
+}
+
+/**
+ * Links a prepared node in key order
+ */
+void HashSkip_insert(Hash *this, HashNode *node) {
+  HashSkipList *list = this->sorted;
+  HashNode **links[HASH_SKIP_LEVELS];
+  HashSkip_find(list, node->data.key, node->data.keyLength, links);
+  while (list->levels < node->levels) {
+    links[list->levels] = list->head;
+    list->levels += 1;
+  }
+  for (unsigned level = 0; level < node->levels; level++) {
+    node->forward[level] = links[level][level];
+    links[level][level] = node;
+  }
+}
+
+/**
+ * Unlinks a node from the index, its tower is kept
+ */
+void HashSkip_remove(Hash *this, HashNode *node) {
+  HashSkipList *list = this->sorted;
+  HashNode **links[HASH_SKIP_LEVELS];
+  HashSkip_find(list, node->data.key, node->data.keyLength, links);
+  for (unsigned level = 0; level < node->levels; level++) {
+    if (links[level][level] == node) links[level][level] = node->forward[level];
+  }
+  while (list->levels > 0 && list->head[list->levels - 1] == NULL) {
+    list->levels -= 1;
+  }
+}
+
+/**
+ * Releases the tower of a node
+ */
+void HashSkip_freeTower(Hash *this, HashNode *node) {
+  if (this->arena != NULL) {
+    HashArena_free(this->arena, node->forward, node->levels * sizeof(HashNode *));
+  } else {
+    HashAllocator_free(&(this->allocator), node->forward);
+  }
+  node->forward = NULL;
+  node->levels = 0;
+}
+
+/**
+ * Empties the index, the towers are released with their nodes
+ */
+void HashSkip_purge(Hash *this) {
+  memset(this->sorted->head, 0, sizeof(this->sorted->head));
+  this->sorted->levels = 0;
+}
+
+/**
+ * Releases the index
+ */
+void HashSkip_free(Hash *this) {
+  HashAllocator_free(&(this->allocator), this->sorted);
+  this->sorted = NULL;
+}
+
+/**
+ * Gets the node with the smallest key
+ */
+HashNode *HashSkip_first(const Hash *this) {
+  return this->sorted->head[0];
+}
+
+/**
+ * Gets the node with the largest key, going down from the top level
+ */
+HashNode *HashSkip_last(const Hash *this) {
+  HashNode *const *current = this->sorted->head;
+  HashNode *node = NULL;
+  for (unsigned level = this->sorted->levels; level > 0; level--) {
+    while (current[level - 1] != NULL) {
+      node = current[level - 1];
+      current = node->forward;
+    }
+  }
+  return node;
+}
+
+/**
+ * Returns the next item of a sorted iteration, or NULL
+ * when the end of the index or the limit is reached
+ */
+const Tuple *HashSkip_next(HashIter *iter) {
+  const HashNode *node = (const HashNode *)iter->node;
+  if (node == NULL) return NULL;
+  if (iter->limit != NULL) {
+    bool done = iter->prefix
+      ? (node->data.keyLength < iter->limitLength || memcmp(node->data.key, iter->limit, iter->limitLength) != 0)
+      : (HashSkip_compare(node, iter->limit, iter->limitLength) >= 0);
+    if (done) {
+      iter->node = NULL;
+      return NULL;
+    }
+  }
+  iter->node = node->forward[0];
+  return &(node->data);
+}
+
+/**
+ * Sets up the iterator for the keys between low and high
+ */
+bool Hash_range(const Hash *this, HashIter *iter, const char *low, const char *high) {
+  HashIter_init(iter, this);
+  if (this->sorted == NULL) {
+    iter->hash = NULL;
+    return false;
+  }
+  if (low != NULL) iter->node = HashSkip_seek(this, low, strlen(low));
+  if (high != NULL) {
+    iter->limit = high;
+    iter->limitLength = strlen(high);
+  }
+  return true;
+}
+
+/**
+ * Sets up the iterator for the keys with the given prefix
+ */
+bool Hash_prefix(const Hash *this, HashIter *iter, const char *prefix) {
+  HashIter_init(iter, this);
+  if (this->sorted == NULL) {
+    iter->hash = NULL;
+    return false;
+  }
+  iter->node = HashSkip_seek(this, prefix, strlen(prefix));
+  iter->limit = prefix;
+  iter->limitLength = strlen(prefix);
+  iter->prefix = true;
+  return true;
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hash_private.h"
+
+/**
+ * Creates the lookup counters, all set to zero
+ */
+HashCounters *HashCounters_new(const HashAllocator *allocator) {
+  HashCounters *this = (HashCounters *)HashAllocator_alloc(allocator, sizeof(HashCounters));
+  if (this == NULL) return NULL;
+  atomic_init(&(this->lookups), 0);
+  atomic_init(&(this->hits), 0);
+  atomic_init(&(this->comparisons), 0);
+  return this;
+}
+
+/**
+ * Counts a lookup and the nodes compared with its key
+ * The counters don't order any other memory access, so the
+ * additions are relaxed
+ */
+void HashCounters_add(HashCounters *this, bool hit, size_t compared) {
+  atomic_fetch_add_explicit(&(this->lookups), 1, memory_order_relaxed);
+  if (hit) atomic_fetch_add_explicit(&(this->hits), 1, memory_order_relaxed);
+  if (compared > 0) atomic_fetch_add_explicit(&(this->comparisons), compared, memory_order_relaxed);
+}
+
+/**
+ * Adds a chain, or a probe sequence, of the given length to the histogram
+ */
+void HashStats_addChain(HashStats *stats, size_t length) {
+  stats->chains[(length < HASH_STATS_CHAINS) ? length : HASH_STATS_CHAINS - 1] += 1;
+  if (length > stats->maxProbe) stats->maxProbe = length;
+}
+
+/**
+ * Walks the buckets of both tables of a chained Hash
+ */
+static void HashStats_chained(const Hash *this, HashStats *stats) {
+  for (int t = 0; t < 2; t++) {
+    const HashTable *table = &(this->table[t]);
+    stats->buckets += table->size;
+    stats->tableBytes += table->size * sizeof(HashNode *);
+    for (size_t i = 0; i < table->size; i++) {
+      size_t length = 0;
+      for (const HashNode *node = table->buckets[i]; node != NULL; node = node->next) {
+        HashNode_measure(node, this, stats);
+        length++;
+      }
+      HashStats_addChain(stats, length);
+    }
+  }
+}
+
+/**
+ * Walks the slots of an open addressing Hash
+ * The histogram counts the items by number of groups probed to find them
+ */
+static void HashStats_open(const Hash *this, HashStats *stats) {
+  const HashOpenTable *table = &(this->open);
+  stats->buckets += table->size;
+  stats->tableBytes += table->size * sizeof(HashNode *) + table->size + HASH_GROUP_WIDTH;
+  for (size_t i = 0; i < table->size; i++) {
+    if (table->ctrl[i] < 0) continue;
+    HashNode_measure(table->slots[i], this, stats);
+    HashStats_addChain(stats, HashOpen_groupsFor(this, i));
+  }
+}
+
+/**
+ * Fills the given HashStats, visiting all the buckets of the hash
+ */
+void Hash_stats(const Hash *this, HashStats *stats) {
+  memset(stats, 0, sizeof(HashStats));
+  stats->items = (size_t)this->length;
+  if (this->mapped != NULL) {
+    HashMapped_stats(this, stats);
+  } else if (this->backend == HASH_OPEN) {
+    HashStats_open(this, stats);
+  } else {
+    HashStats_chained(this, stats);
+  }
+  stats->tableBytes += this->entriesSize * sizeof(HashNode *);
+  if (stats->buckets > 0) stats->loadFactor = (double)stats->items / (double)stats->buckets;
+  if (this->counters == NULL) return;
+  stats->counting = true;
+  stats->lookups = atomic_load_explicit(&(this->counters->lookups), memory_order_relaxed);
+  stats->hits = atomic_load_explicit(&(this->counters->hits), memory_order_relaxed);
+  stats->comparisons = atomic_load_explicit(&(this->counters->comparisons), memory_order_relaxed);
+  // Lookups running on other threads can be counted in between the loads
+  if (stats->hits > stats->lookups) stats->hits = stats->lookups;
+  stats->misses = stats->lookups - stats->hits;
+  if (stats->lookups > 0) stats->comparisonsPerLookup = (double)stats->comparisons / (double)stats->lookups;
+}
@@ -0,0 +1,248 @@
+/**
+ * Copyright (C) 2021 Vito Tardia
+ *
+ * This file is part of vHashLib.
+ *
+ * vHashLib is a simple C implementation of hashes
+ * (associative arrays) using Hash Tables.
+ *
+ * vHashLib is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef HASH_TYPED_H
+#define HASH_TYPED_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
+  #include <stdlib.h>
+  #include <string.h>
+
+  /**
+   * Typed hashes are generated at compile-time for a key type and a value
+   * type, with VHASH_DECLARE(name, KeyType, ValueType, hashFunction, equalFunction)
+   *
+   * The hash function has the signature uint64_t (KeyType key)
+   * and the equal function has the signature bool (KeyType a, KeyType b);
+   * both can be static inline functions or macros, so that the compiler
+   * can inline them in the generated code.
+   *
+   * The declaration creates the type `name` and the functions:
+   *   name *name_new(size_t capacity);
+   *   void name_free(name **this);
+   *   size_t name_length(const name *this);
+   *   bool name_set(name *this, KeyType key, ValueType value);
+   *   ValueType *name_get(const name *this, KeyType key);
+   *   bool name_has(const name *this, KeyType key);
+   *   bool name_delete(name *this, KeyType key);
+   *   bool name_next(const name *this, size_t *position, KeyType *key, ValueType **value);
+   *
+   * Keys and values are stored by value in a flat array, using linear
+   * probing like IntHash. Pointer keys, like strings, are not copied.
+   */
+
+  /**
+   * The smallest table has 8 slots
+   */
+  #define VHASH_MIN_SIZE 8
+
+  /**
+   * Spreads the bits of an integer key (the splitmix64 finalizer)
+   */
+  static inline uint64_t VHash_intHash(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    return key ^ (key >> 31);
+  }
+
+  static inline bool VHash_intEqual(uint64_t a, uint64_t b) {
+    return a == b;
+  }
+
+  /**
+   * FNV-1a hash of a NULL terminated string
+   */
+  static inline uint64_t VHash_stringHash(const char *key) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+      hash = (hash ^ *c) * 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  static inline bool VHash_stringEqual(const char *a, const char *b) {
+    return strcmp(a, b) == 0;
+  }
+
+  /**
+   * Returns the number of slots for the given capacity at 3/4 load,
+   * always a power of two
+   */
+  static inline size_t VHash_tableSize(size_t capacity) {
+    size_t size = VHASH_MIN_SIZE;
+    while (size - size / 4 < capacity) size *= 2;
+    return size;
+  }
+
+  #define VHASH_DECLARE(name, KeyType, ValueType, hashFunction, equalFunction) \
+    typedef struct { \
+      KeyType key; \
+      ValueType value; \
+    } name##_Item; \
+    \
+    typedef struct { \
+      name##_Item *items; /* Slots */ \
+      unsigned char *used; /* 1 for each slot that contains an item */ \
+      size_t size; /* Number of slots, always a power of two */ \
+      unsigned shift; /* 64 - log2(size) */ \
+      size_t length; /* Number of items */ \
+    } name; \
+    \
+    /* Fibonacci hashing: the highest bits of the product select the slot */ \
+    static inline size_t name##_indexFor(const name *this, KeyType key) { \
+      return (size_t)((hashFunction(key) * 0x9e3779b97f4a7c15ull) >> this->shift); \
+    } \
+    \
+    static inline bool name##_alloc(name *this, size_t size) { \
+      name##_Item *items = (name##_Item *)malloc(size * sizeof(name##_Item)); \
+      unsigned char *used = (unsigned char *)calloc(size, 1); \
+      if (items == NULL || used == NULL) { \
+        free(items); \
+        free(used); \
+        return false; \
+      } \
+      this->items = items; \
+      this->used = used; \
+      this->size = size; \
+      this->shift = 64; \
+      while (size > 1) { \
+        size >>= 1; \
+        this->shift--; \
+      } \
+      return true; \
+    } \
+    \
+    /* Finds the slot of the given key, or the empty slot where it should go */ \
+    static inline size_t name##_find(const name *this, KeyType key) { \
+      size_t mask = this->size - 1; \
+      size_t index = name##_indexFor(this, key); \
+      while (this->used[index] && !equalFunction(this->items[index].key, key)) { \
+        index = (index + 1) & mask; \
+      } \
+      return index; \
+    } \
+    \
+    static inline bool name##_resize(name *this, size_t size) { \
+      name old = *this; \
+      if (!name##_alloc(this, size)) { \
+        *this = old; \
+        return false; \
+      } \
+      for (size_t i = 0; i < old.size; i++) { \
+        if (!old.used[i]) continue; \
+        size_t index = name##_find(this, old.items[i].key); \
+        this->items[index] = old.items[i]; \
+        this->used[index] = 1; \
+      } \
+      free(old.items); \
+      free(old.used); \
+      return true; \
+    } \
+    \
+    static inline name *name##_new(size_t capacity) { \
+      name *this = (name *)calloc(sizeof(name), 1); \
+      if (this == NULL) return NULL; \
+      if (!name##_alloc(this, VHash_tableSize(capacity))) { \
+        free(this); \
+        return NULL; \
+      } \
+      return this; \
+    } \
+    \
+    static inline void name##_free(name **this) { \
+      if (this != NULL && *this != NULL) { \
+        free((*this)->items); \
+        free((*this)->used); \
+        free(*this); \
+        *this = NULL; \
+      } \
+    } \
+    \
+    static inline size_t name##_length(const name *this) { \
+      return this->length; \
+    } \
+    \
+    /* Adds or replaces the item for the given key */ \
+    static inline bool name##_set(name *this, KeyType key, ValueType value) { \
+      size_t index = name##_find(this, key); \
+      if (!this->used[index]) { \
+        if (this->length + 1 > this->size - this->size / 4) { \
+          if (!name##_resize(this, this->size * 2)) return false; \
+          index = name##_find(this, key); \
+        } \
+        this->items[index].key = key; \
+        this->used[index] = 1; \
+        this->length += 1; \
+      } \
+      this->items[index].value = value; \
+      return true; \
+    } \
+    \
+    /* Returns a pointer to the value in the table, valid until the next set or delete */ \
+    static inline ValueType *name##_get(const name *this, KeyType key) { \
+      size_t index = name##_find(this, key); \
+      return this->used[index] ? &(this->items[index].value) : NULL; \
+    } \
+    \
+    static inline bool name##_has(const name *this, KeyType key) { \
+      return this->used[name##_find(this, key)] != 0; \
+    } \
+    \
+    /* Deletes the item and shifts back the items that follow in the cluster */ \
+    static inline bool name##_delete(name *this, KeyType key) { \
+      size_t mask = this->size - 1; \
+      size_t hole = name##_find(this, key); \
+      if (!this->used[hole]) return false; \
+      size_t index = hole; \
+      while (true) { \
+        index = (index + 1) & mask; \
+        if (!this->used[index]) break; \
+        size_t ideal = name##_indexFor(this, this->items[index].key); \
+        if (((index - ideal) & mask) >= ((index - hole) & mask)) { \
+          this->items[hole] = this->items[index]; \
+          hole = index; \
+        } \
+      } \
+      this->used[hole] = 0; \
+      this->length -= 1; \
+      return true; \
+    } \
+    \
+    /* Gets the item at the given position or after it, and moves the position past it */ \
+    static inline bool name##_next(const name *this, size_t *position, KeyType *key, ValueType **value) { \
+      while (*position < this->size) { \
+        size_t index = (*position)++; \
+        if (!this->used[index]) continue; \
+        if (key != NULL) *key = this->items[index].key; \
+        if (value != NULL) *value = &(this->items[index].value); \
+        return true; \
+      } \
+      return false; \
+    }
+
+#endif
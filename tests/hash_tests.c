@@ -26,8 +26,11 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "hash.h"
+#include "hash_typed.h"
 #include "hash_tests.h"
 
 // Test new, free, empty
@@ -104,7 +107,10 @@ void TestHash_set() {
 }
 
 void TestHash_first() {
-  Hash *myhash = Hash_new();
+  // Bucket order follows the byte values of single char keys
+  // only with the additive hash function
+  HashOptions options = {.function = HashFunction_sum};
+  Hash *myhash = Hash_newWith(&options);
 
   // Test that the first element of an empty hash is NULL
   Tuple *item = Hash_first(myhash);
@@ -145,7 +151,8 @@ void TestHash_first() {
 }
 
 void TestHash_last() {
-  Hash *myhash = Hash_new();
+  HashOptions options = {.function = HashFunction_sum};
+  Hash *myhash = Hash_newWith(&options);
 
   // Test that the last element of an empty hash is NULL
   Tuple *item = Hash_last(myhash);
@@ -219,6 +226,1641 @@ void TestHash_delete() {
   Hash_free(&myhash);
 }
 
+// Fills a hash well beyond its initial size so that it grows,
+// then deletes most items so that it shrinks back
+void TestHash_resize() {
+  HashOptions options = {.capacity = 4};
+  Hash *myhash = Hash_newWith(&options);
+  assert(myhash != NULL);
+  printf(".");
+
+  char key[32] = {0};
+  int total = 10000;
+  for (int i = 0; i < total; i++) {
+    snprintf(key, sizeof(key), "key:%d", i);
+    assert(Hash_set(myhash, key, &i, sizeof(int)));
+  }
+  assert(Hash_length(myhash) == total);
+  printf(".");
+
+  // All the items are still reachable, including the ones
+  // that were moved while the hash was growing
+  for (int i = 0; i < total; i++) {
+    snprintf(key, sizeof(key), "key:%d", i);
+    assert(*((int*)Hash_getValue(myhash, key)) == i);
+  }
+  printf(".");
+
+  // Overriding values does not change the length
+  for (int i = 0; i < total; i += 2) {
+    int value = -i;
+    snprintf(key, sizeof(key), "key:%d", i);
+    assert(Hash_set(myhash, key, &value, sizeof(int)));
+  }
+  assert(Hash_length(myhash) == total);
+  printf(".");
+
+  // Delete all items but the last ten
+  for (int i = 0; i < total - 10; i++) {
+    snprintf(key, sizeof(key), "key:%d", i);
+    assert(Hash_delete(myhash, key));
+    assert(Hash_getValue(myhash, key) == NULL);
+  }
+  assert(Hash_length(myhash) == 10);
+  printf(".");
+
+  for (int i = total - 10; i < total; i++) {
+    snprintf(key, sizeof(key), "key:%d", i);
+    int expected = (i % 2 == 0) ? -i : i;
+    assert(*((int*)Hash_getValue(myhash, key)) == expected);
+  }
+  printf(".");
+
+  Hash_free(&myhash);
+  assert(myhash == NULL);
+  printf(".");
+}
+
+// Tests the hash functions and their use within a Hash
+void TestHash_functions() {
+  // SipHash-2-4 reference vectors, key 00 01 02 ... 0f
+  uint64_t key[2] = {0x0706050403020100ull, 0x0f0e0d0c0b0a0908ull};
+  unsigned char message[15] = {0};
+  for (int i = 0; i < 15; i++) message[i] = i;
+  assert(HashFunction_siphash(message, 0, key) == 0x726fdb47dd0e0e31ull);
+  printf(".");
+  assert(HashFunction_siphash(message, 8, key) == 0x93f5f5799a932462ull);
+  printf(".");
+  assert(HashFunction_siphash(message, 15, key) == 0xa129ca6149be45e5ull);
+  printf(".");
+
+  // Anagrams collide with the additive function but not with wyhash
+  assert(HashFunction_sum("user:1234", 9, NULL) == HashFunction_sum("user:4321", 9, NULL));
+  printf(".");
+  assert(HashFunction_wyhash("user:1234", 9, NULL) != HashFunction_wyhash("user:4321", 9, NULL));
+  printf(".");
+
+  // The seed changes the result
+  assert(HashFunction_wyhash("user:1234", 9, key) != HashFunction_wyhash("user:1234", 9, NULL));
+  printf(".");
+  assert(HashFunction_siphash("user:1234", 9, key) != HashFunction_siphash("user:1234", 9, NULL));
+  printf(".");
+
+  // A hash can use a keyed function
+  HashOptions options = {.function = HashFunction_siphash, .seed = {42, 24}};
+  Hash *myhash = Hash_newWith(&options);
+  assert(Hash_set(myhash, "user:1234", "alice", 6));
+  printf(".");
+  assert(Hash_set(myhash, "user:4321", "bob", 4));
+  printf(".");
+  assert(strcmp((char*)Hash_getValue(myhash, "user:1234"), "alice") == 0);
+  printf(".");
+  assert(strcmp((char*)Hash_getValue(myhash, "user:4321"), "bob") == 0);
+  printf(".");
+  Hash_free(&myhash);
+
+  // Anagrams have the same hash and length with the additive function,
+  // so the keys must still be compared byte by byte
+  options = (HashOptions){.function = HashFunction_sum};
+  myhash = Hash_newWith(&options);
+  assert(Hash_set(myhash, "user:1234", "alice", 6));
+  assert(Hash_set(myhash, "user:4321", "bob", 4));
+  assert(Hash_set(myhash, "user:3412", "chris", 6));
+  assert(Hash_length(myhash) == 3);
+  printf(".");
+  assert(strcmp((char*)Hash_getValue(myhash, "user:4321"), "bob") == 0);
+  assert(Hash_getValue(myhash, "user:2143") == NULL);
+  printf(".");
+  assert(Hash_delete(myhash, "user:1234"));
+  assert(strcmp((char*)Hash_getValue(myhash, "user:3412"), "chris") == 0);
+  printf(".");
+  Hash_free(&myhash);
+}
+
+// Tests the open addressing backend through the same API
+void TestHash_open() {
+  HashOptions options = {.backend = HASH_OPEN};
+  Hash *myhash = Hash_newWith(&options);
+  assert(myhash != NULL);
+  printf(".");
+
+  // The first and last items of an empty hash are NULL
+  assert(Hash_first(myhash) == NULL);
+  assert(Hash_last(myhash) == NULL);
+  assert(!Hash_delete(myhash, "fool"));
+  printf(".");
+
+  assert(Hash_set(myhash, "bob", "bar", 4));
+  assert(Hash_set(myhash, "alice", "foo", 4));
+  assert(Hash_set(myhash, "chris", "baz", 4));
+  assert(Hash_length(myhash) == 3);
+  printf(".");
+
+  Tuple *item = Hash_get(myhash, "alice");
+  assert(strcmp(item->key, "alice") == 0);
+  assert(strcmp((char*)item->value, "foo") == 0);
+  Tuple_free(&item);
+  printf(".");
+
+  // Test that we can override values
+  assert(Hash_set(myhash, "bob", "fizzbuz", 8));
+  assert(strcmp((char*)Hash_getValue(myhash, "bob"), "fizzbuz") == 0);
+  assert(Hash_length(myhash) == 3);
+  printf(".");
+
+  item = Hash_first(myhash);
+  assert(item != NULL);
+  Tuple_free(&item);
+  item = Hash_last(myhash);
+  assert(item != NULL);
+  Tuple_free(&item);
+  printf(".");
+
+  assert(Hash_delete(myhash, "bob"));
+  assert(Hash_getValue(myhash, "bob") == NULL);
+  assert(!Hash_delete(myhash, "bob"));
+  assert(Hash_length(myhash) == 2);
+  printf(".");
+
+  // Grow the table, then delete and insert again so that
+  // deleted slots are reused
+  char key[32] = {0};
+  int total = 10000;
+  for (int i = 0; i < total; i++) {
+    snprintf(key, sizeof(key), "key:%d", i);
+    assert(Hash_set(myhash, key, &i, sizeof(int)));
+  }
+  assert(Hash_length(myhash) == total + 2);
+  printf(".");
+  for (int i = 0; i < total; i += 2) {
+    snprintf(key, sizeof(key), "key:%d", i);
+    assert(Hash_delete(myhash, key));
+  }
+  for (int i = 0; i < total; i++) {
+    snprintf(key, sizeof(key), "key:%d", i);
+    int *value = (int*)Hash_getValue(myhash, key);
+    assert((i % 2 == 0) ? value == NULL : *value == i);
+  }
+  printf(".");
+  for (int i = 0; i < total; i += 2) {
+    snprintf(key, sizeof(key), "new:%d", i);
+    assert(Hash_set(myhash, key, &i, sizeof(int)));
+    assert(*((int*)Hash_getValue(myhash, key)) == i);
+  }
+  assert(Hash_length(myhash) == total + 2);
+  printf(".");
+
+  // Shrink back
+  for (int i = 0; i < total; i++) {
+    snprintf(key, sizeof(key), (i % 2 == 0) ? "new:%d" : "key:%d", i);
+    assert(Hash_delete(myhash, key));
+  }
+  assert(Hash_length(myhash) == 2);
+  assert(strcmp((char*)Hash_getValue(myhash, "chris"), "baz") == 0);
+  printf(".");
+
+  Hash_free(&myhash);
+  assert(myhash == NULL);
+  printf(".");
+}
+
+// Tests the arena allocator with both storage engines
+void TestHash_arena() {
+  HashBackend backends[] = {HASH_CHAINED, HASH_OPEN};
+  for (int b = 0; b < 2; b++) {
+    HashOptions options = {.arena = true, .backend = backends[b]};
+    Hash *myhash = Hash_newWith(&options);
+    assert(myhash != NULL);
+    printf(".");
+
+    char key[32] = {0};
+    int total = 5000;
+    for (int i = 0; i < total; i++) {
+      snprintf(key, sizeof(key), "key:%d", i);
+      assert(Hash_set(myhash, key, &i, sizeof(int)));
+    }
+    assert(Hash_length(myhash) == total);
+    printf(".");
+
+    // Deleted nodes and blocks are reused by the next items
+    for (int i = 0; i < total; i += 2) {
+      snprintf(key, sizeof(key), "key:%d", i);
+      assert(Hash_delete(myhash, key));
+    }
+    for (int i = 0; i < total; i += 2) {
+      snprintf(key, sizeof(key), "new:%d", i);
+      assert(Hash_set(myhash, key, &i, sizeof(int)));
+    }
+    for (int i = 0; i < total; i++) {
+      snprintf(key, sizeof(key), (i % 2 == 0) ? "new:%d" : "key:%d", i);
+      assert(*((int*)Hash_getValue(myhash, key)) == i);
+    }
+    printf(".");
+
+    // Big values get a chunk of their own, empty values are allowed
+    size_t bigLength = 100000;
+    char *big = malloc(bigLength);
+    memset(big, 'x', bigLength);
+    big[bigLength - 1] = '\0';
+    assert(Hash_set(myhash, "big", big, bigLength));
+    assert(strcmp((char*)Hash_getValue(myhash, "big"), big) == 0);
+    assert(Hash_set(myhash, "big", "small", 6));
+    assert(strcmp((char*)Hash_getValue(myhash, "big"), "small") == 0);
+    assert(Hash_set(myhash, "empty", "", 0));
+    assert(Hash_getValue(myhash, "empty") != NULL);
+    free(big);
+    printf(".");
+
+    Tuple *item = Hash_get(myhash, "key:1");
+    assert(strcmp(item->key, "key:1") == 0);
+    assert(*((int*)item->value) == 1);
+    Tuple_free(&item);
+    printf(".");
+
+    Hash_free(&myhash);
+    assert(myhash == NULL);
+    printf(".");
+  }
+}
+
+// Tests the lookups that don't allocate memory
+void TestHash_ref() {
+  HashOptions options = {.function = HashFunction_sum};
+  Hash *myhash = Hash_newWith(&options);
+
+  assert(Hash_getRef(myhash, "a") == NULL);
+  assert(Hash_firstRef(myhash) == NULL);
+  assert(Hash_lastRef(myhash) == NULL);
+  printf(".");
+
+  assert(Hash_set(myhash, "b", "bar", 4));
+  assert(Hash_set(myhash, "a", "foo", 4));
+  assert(Hash_set(myhash, "c", "baz", 4));
+  printf(".");
+
+  // The borrowed Tuple points to the data within the hash
+  const Tuple *ref = Hash_getRef(myhash, "b");
+  assert(strcmp(ref->key, "b") == 0);
+  assert(strcmp((char*)ref->value, "bar") == 0);
+  assert(ref->length == 4);
+  assert(ref->value == Hash_getValue(myhash, "b"));
+  printf(".");
+
+  // The caller-provided Tuple gets a copy of the same data
+  Tuple item = {0};
+  assert(Hash_getInto(myhash, "c", &item));
+  assert(strcmp(item.key, "c") == 0);
+  assert(strcmp((char*)item.value, "baz") == 0);
+  assert(!Hash_getInto(myhash, "z", &item));
+  assert(strcmp(item.key, "c") == 0);
+  printf(".");
+
+  assert(strcmp(Hash_firstRef(myhash)->key, "a") == 0);
+  assert(strcmp(Hash_lastRef(myhash)->key, "c") == 0);
+  printf(".");
+
+  Hash_free(&myhash);
+}
+
+// Tests a hash that does not wipe the memory when freed
+void TestHash_fastFree() {
+  HashBackend backends[] = {HASH_CHAINED, HASH_OPEN};
+  for (int b = 0; b < 2; b++) {
+    for (int arena = 0; arena < 2; arena++) {
+      HashOptions options = {.fastFree = true, .backend = backends[b], .arena = arena};
+      Hash *myhash = Hash_newWith(&options);
+      assert(Hash_set(myhash, "b", "bar", 4));
+      assert(Hash_set(myhash, "a", "foo", 4));
+      assert(Hash_set(myhash, "b", "fizzbuz", 8));
+      assert(strcmp((char*)Hash_getValue(myhash, "b"), "fizzbuz") == 0);
+      printf(".");
+      assert(Hash_delete(myhash, "a"));
+      assert(Hash_getValue(myhash, "a") == NULL);
+      assert(Hash_length(myhash) == 1);
+      printf(".");
+      Hash_free(&myhash);
+      assert(myhash == NULL);
+      printf(".");
+    }
+  }
+}
+
+// Tests that updates reuse the existing value buffer when possible
+void TestHash_update() {
+  HashBackend backends[] = {HASH_CHAINED, HASH_OPEN};
+  for (int b = 0; b < 2; b++) {
+    for (int arena = 0; arena < 2; arena++) {
+      HashOptions options = {.backend = backends[b], .arena = arena};
+      Hash *myhash = Hash_newWith(&options);
+      assert(Hash_set(myhash, "counter", "0000000000", 11));
+      const Tuple *item = Hash_getRef(myhash, "counter");
+      void *buffer = item->value;
+      printf(".");
+
+      // Same size and smaller values are written in place,
+      // the node and the key are kept
+      assert(Hash_set(myhash, "counter", "0000000001", 11));
+      assert(Hash_getRef(myhash, "counter") == item);
+      assert(item->value == buffer);
+      assert(strcmp((char*)item->value, "0000000001") == 0);
+      printf(".");
+      assert(Hash_set(myhash, "counter", "2", 2));
+      assert(item->value == buffer);
+      assert(item->length == 2);
+      assert(strcmp((char*)item->value, "2") == 0);
+      printf(".");
+      assert(Hash_set(myhash, "counter", "0000000003", 11));
+      assert(item->value == buffer);
+      assert(strcmp((char*)item->value, "0000000003") == 0);
+      printf(".");
+
+      // A value can be updated with a part of itself
+      assert(Hash_set(myhash, "counter", (char*)item->value + 9, 2));
+      assert(strcmp((char*)item->value, "3") == 0);
+      printf(".");
+
+      // Bigger values need a new buffer
+      char big[200] = {0};
+      memset(big, 'x', sizeof(big) - 1);
+      assert(Hash_set(myhash, "counter", big, sizeof(big)));
+      assert(Hash_getRef(myhash, "counter") == item);
+      assert(strcmp((char*)item->value, big) == 0);
+      assert(strcmp(item->key, "counter") == 0);
+      assert(Hash_length(myhash) == 1);
+      printf(".");
+
+      Hash_free(&myhash);
+    }
+  }
+}
+
+static int destroyed = 0;
+
+static void TestHash_destroy(void *value, size_t length) {
+  (void)value;
+  (void)length;
+  destroyed++;
+}
+
+static void TestHash_destroyHeap(void *value, size_t length) {
+  (void)length;
+  free(value);
+  destroyed++;
+}
+
+void TestHash_setRef() {
+  HashBackend backends[] = {HASH_CHAINED, HASH_OPEN};
+  for (int b = 0; b < 2; b++) {
+    for (int arena = 0; arena < 2; arena++) {
+      HashOptions options = {.backend = backends[b], .arena = arena};
+      Hash *myhash = Hash_newWith(&options);
+      static char first[] = "first value";
+      static char second[] = "second value";
+      destroyed = 0;
+
+      // Borrowed values are not copied
+      assert(Hash_setRef(myhash, "borrowed", first, sizeof(first), TestHash_destroy));
+      assert(Hash_getValue(myhash, "borrowed") == first);
+      assert(Hash_getRef(myhash, "borrowed")->length == sizeof(first));
+      printf(".");
+
+      // Replacing or deleting a value calls the destructor
+      assert(Hash_setRef(myhash, "borrowed", second, sizeof(second), TestHash_destroy));
+      assert(destroyed == 1);
+      assert(Hash_getValue(myhash, "borrowed") == second);
+      assert(Hash_set(myhash, "borrowed", "copy", 5));
+      assert(destroyed == 2);
+      assert(Hash_getValue(myhash, "borrowed") != second);
+      assert(strcmp((char*)Hash_getValue(myhash, "borrowed"), "copy") == 0);
+      assert(Hash_setRef(myhash, "borrowed", first, sizeof(first), TestHash_destroy));
+      assert(Hash_delete(myhash, "borrowed"));
+      assert(destroyed == 3);
+      assert(Hash_length(myhash) == 0);
+      printf(".");
+
+      // Owned values are freed by the Hash
+      char *owned = strdup("owned value");
+      assert(Hash_setOwned(myhash, "owned", owned, strlen(owned) + 1));
+      assert(Hash_getValue(myhash, "owned") == owned);
+      assert(Hash_setOwned(myhash, "owned", strdup("new value"), 10));
+      assert(strcmp((char*)Hash_getValue(myhash, "owned"), "new value") == 0);
+      printf(".");
+
+      // A value can be replaced by a copy of itself,
+      // the old one is released once, after the copy
+      char *self = strdup("a value longer than the inline buffer of a node");
+      size_t selfLength = strlen(self) + 1;
+      assert(Hash_setRef(myhash, "self", self, selfLength, TestHash_destroyHeap));
+      assert(Hash_set(myhash, "self", Hash_getRef(myhash, "self")->value, selfLength));
+      assert(destroyed == 4);
+      assert(strcmp((char*)Hash_getValue(myhash, "self"), "a value longer than the inline buffer of a node") == 0);
+      assert(Hash_set(myhash, "owned", Hash_getRef(myhash, "owned")->value, 10));
+      assert(strcmp((char*)Hash_getValue(myhash, "owned"), "new value") == 0);
+      assert(Hash_delete(myhash, "self"));
+      assert(destroyed == 4);
+      printf(".");
+
+      // Setting the same borrowed or owned pointer again keeps it alive
+      self = strdup("a borrowed value set twice");
+      assert(Hash_setRef(myhash, "self", self, strlen(self) + 1, TestHash_destroyHeap));
+      assert(Hash_setRef(myhash, "self", self, strlen(self) + 1, TestHash_destroyHeap));
+      assert(destroyed == 4);
+      assert(strcmp((char*)Hash_getValue(myhash, "self"), "a borrowed value set twice") == 0);
+      assert(Hash_delete(myhash, "self"));
+      assert(destroyed == 5);
+      owned = strdup("an owned value set twice");
+      assert(Hash_setOwned(myhash, "owned", owned, strlen(owned) + 1));
+      assert(Hash_setOwned(myhash, "owned", owned, strlen(owned) + 1));
+      assert(strcmp((char*)Hash_getValue(myhash, "owned"), "an owned value set twice") == 0);
+      printf(".");
+
+      // Freeing the Hash releases the values of all kinds
+      assert(Hash_setRef(myhash, "borrowed", first, sizeof(first), TestHash_destroy));
+      assert(Hash_setRef(myhash, "static", second, sizeof(second), NULL));
+      assert(Hash_set(myhash, "copy", "copy", 5));
+      assert(Hash_length(myhash) == 4);
+      Hash_free(&myhash);
+      assert(destroyed == 6);
+      printf(".");
+    }
+  }
+}
+
+#define CONCURRENT_THREADS 8
+#define CONCURRENT_KEYS 2000
+
+typedef struct {
+  ConcurrentHash *hash;
+  int id;
+  int errors;
+} ConcurrentJob;
+
+static void *TestHash_concurrentWorker(void *data) {
+  ConcurrentJob *job = (ConcurrentJob *)data;
+  char key[32];
+  // Each thread writes its own keys, and reads the shared ones
+  for (int i = 0; i < CONCURRENT_KEYS; i++) {
+    snprintf(key, sizeof(key), "thread%d-key%d", job->id, i);
+    if (!ConcurrentHash_set(job->hash, key, &i, sizeof(i))) job->errors++;
+    int value = 0;
+    size_t length = 0;
+    if (!ConcurrentHash_getInto(job->hash, key, &value, sizeof(value), &length)) job->errors++;
+    if (value != i || length != sizeof(i)) job->errors++;
+    snprintf(key, sizeof(key), "shared%d", i % 10);
+    if (!ConcurrentHash_set(job->hash, key, &(job->id), sizeof(job->id))) job->errors++;
+    if (!ConcurrentHash_has(job->hash, key)) job->errors++;
+  }
+  // Then deletes half of its keys
+  for (int i = 0; i < CONCURRENT_KEYS; i += 2) {
+    snprintf(key, sizeof(key), "thread%d-key%d", job->id, i);
+    if (!ConcurrentHash_delete(job->hash, key)) job->errors++;
+  }
+  return NULL;
+}
+
+void TestHash_concurrent() {
+  HashOptions options = {.capacity = 1000};
+  ConcurrentHash *myhash = ConcurrentHash_new(&options, 0);
+  assert(myhash != NULL);
+  assert(ConcurrentHash_length(myhash) == 0);
+  printf(".");
+
+  // Single thread
+  assert(ConcurrentHash_set(myhash, "foo", "bar", 4));
+  size_t length = 0;
+  char *value = (char *)ConcurrentHash_get(myhash, "foo", &length);
+  assert(strcmp(value, "bar") == 0);
+  assert(length == 4);
+  free(value);
+  assert(ConcurrentHash_get(myhash, "baz", NULL) == NULL);
+  assert(ConcurrentHash_delete(myhash, "foo"));
+  assert(!ConcurrentHash_delete(myhash, "foo"));
+  assert(ConcurrentHash_length(myhash) == 0);
+  printf(".");
+
+  // Many threads
+  pthread_t threads[CONCURRENT_THREADS];
+  ConcurrentJob jobs[CONCURRENT_THREADS];
+  for (int t = 0; t < CONCURRENT_THREADS; t++) {
+    jobs[t] = (ConcurrentJob){.hash = myhash, .id = t};
+    assert(pthread_create(&threads[t], NULL, TestHash_concurrentWorker, &jobs[t]) == 0);
+  }
+  for (int t = 0; t < CONCURRENT_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+    assert(jobs[t].errors == 0);
+  }
+  assert(ConcurrentHash_length(myhash) == CONCURRENT_THREADS * CONCURRENT_KEYS / 2 + 10);
+  assert(ConcurrentHash_has(myhash, "thread3-key1"));
+  assert(!ConcurrentHash_has(myhash, "thread3-key2"));
+  printf(".");
+  ConcurrentHash_free(&myhash);
+  assert(myhash == NULL);
+
+  // A single stripe works like a locked Hash
+  myhash = ConcurrentHash_new(NULL, 1);
+  assert(ConcurrentHash_set(myhash, "foo", "bar", 4));
+  assert(ConcurrentHash_has(myhash, "foo"));
+  assert(ConcurrentHash_length(myhash) == 1);
+  ConcurrentHash_free(&myhash);
+  printf(".");
+}
+
+#define RCU_READERS 4
+#define RCU_KEYS 500
+
+typedef struct {
+  RcuHash *hash;
+  atomic_bool *done;
+  int errors;
+} RcuJob;
+
+static void *TestHash_rcuReader(void *data) {
+  RcuJob *job = (RcuJob *)data;
+  char key[32];
+  while (!atomic_load(job->done)) {
+    for (int i = 0; i < RCU_KEYS; i++) {
+      snprintf(key, sizeof(key), "route%d", i);
+      RcuHash_enter();
+      size_t length = 0;
+      const int *value = (const int *)RcuHash_getValue(job->hash, key, &length);
+      // Items come and go, but they are always consistent
+      if (value != NULL && (length != 2 * sizeof(int) || value[0] != i || value[1] < 0)) {
+        job->errors++;
+      }
+      RcuHash_leave();
+    }
+  }
+  return NULL;
+}
+
+void TestHash_rcu() {
+  RcuHash *myhash = RcuHash_new(NULL);
+  assert(myhash != NULL);
+  assert(RcuHash_length(myhash) == 0);
+  assert(RcuHash_set(myhash, "foo", "bar", 4));
+  assert(RcuHash_set(myhash, "foo", "baz", 4));
+  assert(RcuHash_length(myhash) == 1);
+  char buffer[8] = {0};
+  size_t length = 0;
+  assert(RcuHash_getInto(myhash, "foo", buffer, sizeof(buffer), &length));
+  assert(strcmp(buffer, "baz") == 0 && length == 4);
+  assert(RcuHash_has(myhash, "foo"));
+  assert(RcuHash_delete(myhash, "foo"));
+  assert(!RcuHash_delete(myhash, "foo"));
+  assert(!RcuHash_has(myhash, "foo"));
+  printf(".");
+
+  // Values stay valid in a read section, even after they are deleted
+  assert(RcuHash_set(myhash, "foo", "bar", 4));
+  RcuHash_enter();
+  const char *value = (const char *)RcuHash_getValue(myhash, "foo", NULL);
+  assert(RcuHash_delete(myhash, "foo"));
+  assert(RcuHash_set(myhash, "bar", "foo", 4));
+  assert(strcmp(value, "bar") == 0);
+  RcuHash_leave();
+  printf(".");
+
+  // One writer updates the items while the readers look them up
+  atomic_bool done = false;
+  pthread_t threads[RCU_READERS];
+  RcuJob jobs[RCU_READERS];
+  for (int t = 0; t < RCU_READERS; t++) {
+    jobs[t] = (RcuJob){.hash = myhash, .done = &done};
+    assert(pthread_create(&threads[t], NULL, TestHash_rcuReader, &jobs[t]) == 0);
+  }
+  char key[32];
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < RCU_KEYS; i++) {
+      snprintf(key, sizeof(key), "route%d", i);
+      int route[2] = {i, round};
+      assert(RcuHash_set(myhash, key, route, sizeof(route)));
+      if ((i + round) % 3 == 0) assert(RcuHash_delete(myhash, key));
+    }
+  }
+  atomic_store(&done, true);
+  for (int t = 0; t < RCU_READERS; t++) {
+    pthread_join(threads[t], NULL);
+    assert(jobs[t].errors == 0);
+  }
+  printf(".");
+
+  RcuHash_free(&myhash);
+  assert(myhash == NULL);
+  printf(".");
+}
+
+#define MANY_KEYS 1000
+
+void TestHash_getMany() {
+  static char keys[MANY_KEYS][16];
+  const char *keyList[MANY_KEYS];
+  const void *values[MANY_KEYS];
+  size_t lengths[MANY_KEYS];
+  int numbers[MANY_KEYS];
+  const Tuple *items[MANY_KEYS];
+  for (int i = 0; i < MANY_KEYS; i++) {
+    snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+    keyList[i] = keys[i];
+    numbers[i] = i;
+    values[i] = &numbers[i];
+    lengths[i] = sizeof(int);
+  }
+  HashBackend backends[] = {HASH_CHAINED, HASH_OPEN};
+  for (int b = 0; b < 2; b++) {
+    HashOptions options = {.backend = backends[b]};
+    Hash *myhash = Hash_newWith(&options);
+    assert(Hash_getMany(myhash, keyList, MANY_KEYS, items) == 0);
+    assert(items[0] == NULL && items[MANY_KEYS - 1] == NULL);
+    printf(".");
+
+    // Only the first half is set, the table grows meanwhile
+    assert(Hash_setMany(myhash, keyList, values, lengths, MANY_KEYS / 2) == MANY_KEYS / 2);
+    assert(Hash_length(myhash) == MANY_KEYS / 2);
+    printf(".");
+
+    assert(Hash_getMany(myhash, keyList, MANY_KEYS, items) == MANY_KEYS / 2);
+    for (int i = 0; i < MANY_KEYS; i++) {
+      if (i < MANY_KEYS / 2) {
+        assert(items[i] == Hash_getRef(myhash, keys[i]));
+        assert(*(int *)items[i]->value == i);
+      } else {
+        assert(items[i] == NULL);
+      }
+    }
+    printf(".");
+    Hash_free(&myhash);
+  }
+}
+
+#define ITER_KEYS 300
+
+void TestHash_iter() {
+  char key[16];
+  HashBackend backends[] = {HASH_CHAINED, HASH_OPEN};
+  for (int b = 0; b < 2; b++) {
+    for (int ordered = 0; ordered < 2; ordered++) {
+      HashOptions options = {.backend = backends[b], .ordered = ordered};
+      Hash *myhash = Hash_newWith(&options);
+      HashIter iter;
+      HashIter_init(&iter, myhash);
+      assert(HashIter_next(&iter) == NULL);
+      printf(".");
+
+      for (int i = 0; i < ITER_KEYS; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert(Hash_set(myhash, key, &i, sizeof(i)));
+      }
+      // Delete some items and add some of them back
+      for (int i = 0; i < ITER_KEYS; i += 3) {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert(Hash_delete(myhash, key));
+      }
+      for (int i = 0; i < ITER_KEYS; i += 6) {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert(Hash_set(myhash, key, &i, sizeof(i)));
+      }
+      // Updates don't change the order
+      int value = 1;
+      assert(Hash_set(myhash, "key1", &value, sizeof(value)));
+
+      // Every item is visited once
+      char seen[ITER_KEYS] = {0};
+      int count = 0;
+      int previous = -1;
+      bool readded = false;
+      const Tuple *item;
+      HashIter_init(&iter, myhash);
+      while ((item = HashIter_next(&iter)) != NULL) {
+        int i = atoi(item->key + 3);
+        assert(*(int *)item->value == i);
+        assert(seen[i] == 0);
+        seen[i] = 1;
+        count++;
+        if (ordered) {
+          // The items that were added back come last, in the same order
+          if (i % 6 == 0 && !readded) {
+            readded = true;
+            previous = -1;
+          }
+          assert(readded == (i % 6 == 0));
+          assert(i > previous);
+          previous = i;
+        }
+      }
+      assert(count == Hash_length(myhash));
+      printf(".");
+
+      if (ordered) {
+        assert(strcmp(Hash_firstRef(myhash)->key, "key1") == 0);
+        snprintf(key, sizeof(key), "key%d", (ITER_KEYS - 1) / 6 * 6);
+        assert(strcmp(Hash_lastRef(myhash)->key, key) == 0);
+        // Deleting the last item makes the previous one the last
+        assert(Hash_delete(myhash, key));
+        snprintf(key, sizeof(key), "key%d", (ITER_KEYS - 1) / 6 * 6 - 6);
+        assert(strcmp(Hash_lastRef(myhash)->key, key) == 0);
+        printf(".");
+
+        // Deleted entries are reused after many deletes and inserts
+        for (int round = 0; round < 10; round++) {
+          for (int i = 0; i < ITER_KEYS; i++) {
+            snprintf(key, sizeof(key), "key%d", i);
+            Hash_delete(myhash, key);
+            assert(Hash_set(myhash, key, &i, sizeof(i)));
+          }
+        }
+        HashIter_init(&iter, myhash);
+        for (int i = 0; i < ITER_KEYS; i++) {
+          item = HashIter_next(&iter);
+          snprintf(key, sizeof(key), "key%d", i);
+          assert(strcmp(item->key, key) == 0);
+        }
+        assert(HashIter_next(&iter) == NULL);
+        printf(".");
+      }
+
+      Hash_free(&myhash);
+      printf(".");
+    }
+  }
+}
+
+#define SORTED_KEYS 1000
+
+void TestHash_sorted() {
+  char key[16];
+  HashBackend backends[] = {HASH_CHAINED, HASH_OPEN};
+  for (int b = 0; b < 2; b++) {
+    for (int arena = 0; arena < 2; arena++) {
+      HashOptions options = {.backend = backends[b], .arena = arena, .sorted = true};
+      Hash *myhash = Hash_newWith(&options);
+      HashIter iter;
+      assert(Hash_firstRef(myhash) == NULL);
+      assert(Hash_range(myhash, &iter, NULL, NULL));
+      assert(HashIter_next(&iter) == NULL);
+      printf(".");
+
+      // Keys are added in a scrambled order
+      for (int i = 0; i < SORTED_KEYS; i++) {
+        int n = (i * 7919) % SORTED_KEYS;
+        snprintf(key, sizeof(key), "key%04d", n);
+        assert(Hash_set(myhash, key, &n, sizeof(n)));
+      }
+      assert(strcmp(Hash_firstRef(myhash)->key, "key0000") == 0);
+      assert(strcmp(Hash_lastRef(myhash)->key, "key0999") == 0);
+      printf(".");
+
+      // Iteration follows the key order
+      const Tuple *item;
+      int count = 0;
+      HashIter_init(&iter, myhash);
+      while ((item = HashIter_next(&iter)) != NULL) {
+        assert(*(int *)item->value == count);
+        count++;
+      }
+      assert(count == SORTED_KEYS);
+      printf(".");
+
+      // Deleted keys leave the index
+      assert(Hash_delete(myhash, "key0000"));
+      assert(Hash_delete(myhash, "key0999"));
+      assert(Hash_delete(myhash, "key0500"));
+      assert(strcmp(Hash_firstRef(myhash)->key, "key0001") == 0);
+      assert(strcmp(Hash_lastRef(myhash)->key, "key0998") == 0);
+      printf(".");
+
+      // Ranges include the low limit and exclude the high one
+      assert(Hash_range(myhash, &iter, "key0498", "key0503"));
+      const char *expected[] = {"key0498", "key0499", "key0501", "key0502"};
+      for (int i = 0; i < 4; i++) {
+        item = HashIter_next(&iter);
+        assert(strcmp(item->key, expected[i]) == 0);
+      }
+      assert(HashIter_next(&iter) == NULL);
+      assert(Hash_range(myhash, &iter, "key0997", NULL));
+      assert(strcmp(HashIter_next(&iter)->key, "key0997") == 0);
+      assert(strcmp(HashIter_next(&iter)->key, "key0998") == 0);
+      assert(HashIter_next(&iter) == NULL);
+      assert(Hash_range(myhash, &iter, "z", NULL));
+      assert(HashIter_next(&iter) == NULL);
+      printf(".");
+
+      // Prefix scans
+      count = 0;
+      assert(Hash_prefix(myhash, &iter, "key05"));
+      while ((item = HashIter_next(&iter)) != NULL) {
+        assert(strncmp(item->key, "key05", 5) == 0);
+        count++;
+      }
+      assert(count == 99);
+      assert(Hash_prefix(myhash, &iter, "key09"));
+      count = 0;
+      while (HashIter_next(&iter) != NULL) count++;
+      assert(count == 99);
+      assert(Hash_prefix(myhash, &iter, "nokey"));
+      assert(HashIter_next(&iter) == NULL);
+      printf(".");
+
+      // Updates keep the index intact
+      int value = -1;
+      assert(Hash_set(myhash, "key0001", &value, sizeof(value)));
+      assert(*(int *)Hash_firstRef(myhash)->value == -1);
+      Hash_free(&myhash);
+      printf(".");
+    }
+  }
+
+  // Unsorted hashes can't be scanned
+  Hash *myhash = Hash_new();
+  HashIter iter;
+  assert(Hash_set(myhash, "foo", "bar", 4));
+  assert(!Hash_range(myhash, &iter, NULL, NULL));
+  assert(HashIter_next(&iter) == NULL);
+  assert(!Hash_prefix(myhash, &iter, "f"));
+  assert(HashIter_next(&iter) == NULL);
+  Hash_free(&myhash);
+  printf(".");
+}
+
+void TestHash_binary() {
+  HashBackend backends[] = {HASH_CHAINED, HASH_OPEN};
+  for (int b = 0; b < 2; b++) {
+    HashOptions options = {.backend = backends[b], .sorted = true};
+    Hash *myhash = Hash_newWith(&options);
+
+    // Keys that only differ after a NULL byte are different
+    assert(Hash_setn(myhash, "a\0b", 3, "first", 6));
+    assert(Hash_setn(myhash, "a\0c", 3, "second", 7));
+    assert(Hash_setn(myhash, "a", 1, "third", 6));
+    assert(Hash_length(myhash) == 3);
+    const Tuple *item = Hash_getRefn(myhash, "a\0b", 3);
+    assert(strcmp((char*)item->value, "first") == 0);
+    assert(item->keyLength == 3);
+    assert(memcmp(item->key, "a\0b", 4) == 0);
+    assert(strcmp((char*)Hash_getRefn(myhash, "a\0c", 3)->value, "second") == 0);
+    assert(Hash_getRefn(myhash, "a\0d", 3) == NULL);
+    printf(".");
+
+    // Sized keys without NULL bytes are the same as strings
+    assert(strcmp((char*)Hash_getValue(myhash, "a"), "third") == 0);
+    assert(Hash_getRef(myhash, "a")->keyLength == 1);
+    assert(Hash_set(myhash, "abc", "fourth", 7));
+    Tuple *copy = Hash_getn(myhash, "abcdef", 3);
+    assert(strcmp((char*)copy->value, "fourth") == 0);
+    Tuple_free(&copy);
+    printf(".");
+
+    // Structs can be used as keys
+    struct {uint32_t id; uint16_t port; uint16_t zero;} address = {42, 0, 0};
+    assert(Hash_setn(myhash, &address, sizeof(address), "host", 5));
+    address.port = 80;
+    assert(Hash_getRefn(myhash, &address, sizeof(address)) == NULL);
+    address.port = 0;
+    assert(Hash_getRefn(myhash, &address, sizeof(address)) != NULL);
+    printf(".");
+
+    // Byte order puts the struct first (42 is '*') and "a" before "a\0b"
+    assert(Hash_firstRef(myhash)->keyLength == sizeof(address));
+    HashIter iter;
+    assert(Hash_prefix(myhash, &iter, "a"));
+    assert(HashIter_next(&iter)->keyLength == 1);
+    assert(HashIter_next(&iter)->keyLength == 3);
+    printf(".");
+
+    assert(Hash_deleten(myhash, "a\0b", 3));
+    assert(!Hash_deleten(myhash, "a\0b", 3));
+    assert(Hash_getRefn(myhash, "a\0c", 3) != NULL);
+    assert(Hash_length(myhash) == 4);
+    Hash_free(&myhash);
+    printf(".");
+  }
+}
+
+#define INT_KEYS 10000
+
+void TestHash_int() {
+  typedef struct {uint64_t id; uint32_t flags;} Record;
+  IntHash *ids = IntHash_new(sizeof(Record), NULL);
+  assert(ids != NULL);
+  assert(IntHash_length(ids) == 0);
+  assert(IntHash_get(ids, 1) == NULL);
+  assert(IntHash_get(ids, 0) == NULL);
+  printf(".");
+
+  // Keys are spread over the whole range, the table grows
+  for (uint64_t i = 0; i < INT_KEYS; i++) {
+    Record record = {i * 0x100000001ull, (uint32_t)i};
+    assert(IntHash_set(ids, record.id, &record));
+  }
+  assert(IntHash_length(ids) == INT_KEYS);
+  for (uint64_t i = 0; i < INT_KEYS; i++) {
+    Record *record = (Record *)IntHash_get(ids, i * 0x100000001ull);
+    assert(record != NULL && record->flags == i);
+  }
+  assert(!IntHash_has(ids, 7));
+  printf(".");
+
+  // Updates don't add items, 0 is a valid key
+  Record record = {0, 99};
+  assert(IntHash_set(ids, 0, &record));
+  record.flags = 100;
+  assert(IntHash_set(ids, 0, &record));
+  assert(((Record *)IntHash_get(ids, 0))->flags == 100);
+  assert(IntHash_length(ids) == INT_KEYS);
+  printf(".");
+
+  // Deleting half the keys keeps the other ones reachable
+  for (uint64_t i = 1; i < INT_KEYS; i += 2) {
+    assert(IntHash_delete(ids, i * 0x100000001ull));
+  }
+  assert(!IntHash_delete(ids, 0x100000001ull));
+  assert(IntHash_length(ids) == INT_KEYS / 2);
+  for (uint64_t i = 0; i < INT_KEYS; i++) {
+    Record *found = (Record *)IntHash_get(ids, i * 0x100000001ull);
+    if (i % 2 == 1) {
+      assert(found == NULL);
+    } else {
+      assert(found != NULL && found->flags == (i == 0 ? 100 : i));
+    }
+  }
+  printf(".");
+
+  // Iteration visits every item once
+  size_t position = 0;
+  uint64_t key;
+  void *value;
+  int count = 0;
+  while (IntHash_next(ids, &position, &key, &value)) {
+    assert(((Record *)value)->id == key);
+    count++;
+  }
+  assert(count == IntHash_length(ids));
+  assert(IntHash_delete(ids, 0));
+  assert(!IntHash_has(ids, 0));
+  printf(".");
+
+  IntHash_free(&ids);
+  assert(ids == NULL);
+  printf(".");
+
+  // A new key can take the value of another key, even when the table grows
+  IntHash *copies = IntHash_new(64, NULL);
+  assert(copies != NULL);
+  char block[64];
+  memset(block, 'v', sizeof(block));
+  assert(IntHash_set(copies, 1, block));
+  for (uint64_t i = 2; i <= 100; i++) {
+    assert(IntHash_set(copies, i, IntHash_get(copies, i - 1)));
+  }
+  assert(IntHash_set(copies, 0, IntHash_get(copies, 100)));
+  assert(IntHash_length(copies) == 101);
+  assert(memcmp(IntHash_get(copies, 0), block, sizeof(block)) == 0);
+  IntHash_free(&copies);
+  printf(".");
+}
+
+// The buffer inside the items is disabled with 'make -e HASH_INLINE=0'
+#ifndef HASH_INLINE_SIZE
+#define HASH_INLINE_SIZE 32
+#endif
+#define Tuple_inline(item) (HASH_INLINE_SIZE > 0 && (item)->value == (item)->key + 8)
+
+void TestHash_inline() {
+  Hash *myhash = Hash_new();
+  assert(myhash != NULL);
+
+  // A short key and a small value share the item allocation,
+  // the value follows the key at the next 8 bytes boundary
+  uint32_t counter = 1;
+  assert(Hash_set(myhash, "id", &counter, sizeof(counter)));
+  const Tuple *item = Hash_getRef(myhash, "id");
+  assert(item != NULL && Tuple_inline(item) == (HASH_INLINE_SIZE > 0));
+  assert(*(uint32_t *)item->value == 1);
+  printf(".");
+
+  // A bigger value moves to its own buffer, and stays there when it shrinks
+  char big[100];
+  memset(big, 'x', sizeof(big));
+  assert(Hash_set(myhash, "id", big, sizeof(big)));
+  item = Hash_getRef(myhash, "id");
+  assert(!Tuple_inline(item));
+  assert(item->length == sizeof(big) && memcmp(item->value, big, sizeof(big)) == 0);
+  counter = 2;
+  assert(Hash_set(myhash, "id", &counter, sizeof(counter)));
+  item = Hash_getRef(myhash, "id");
+  assert(item->length == sizeof(counter) && *(uint32_t *)item->value == 2);
+  printf(".");
+
+  // Borrowed values are not copied, the item goes back inline after them
+  static char shared[] = "shared";
+  assert(Hash_setRef(myhash, "ref", shared, sizeof(shared), NULL));
+  assert(Hash_getRef(myhash, "ref")->value == shared);
+  assert(Hash_set(myhash, "ref", "copy", 5));
+  item = Hash_getRef(myhash, "ref");
+  assert(Tuple_inline(item) == (HASH_INLINE_SIZE > 0) && strcmp(item->value, "copy") == 0);
+  printf(".");
+
+  // Long keys are allocated separately
+  const char *key = "a key that is too long to fit inside the item";
+  assert(Hash_set(myhash, key, "v", 2));
+  item = Hash_getRef(myhash, key);
+  assert(strcmp(item->key, key) == 0 && strcmp(item->value, "v") == 0);
+  assert(Hash_delete(myhash, "id") && Hash_delete(myhash, key));
+  assert(Hash_length(myhash) == 1);
+  printf(".");
+
+  Hash_free(&myhash);
+  printf(".");
+}
+
+#define MAPPED_FILE "bin/mapped_test.vhash"
+#define MAPPED_KEYS 5000
+
+static uint64_t TestHash_constant(const void *data, size_t length, const uint64_t seed[2]) {
+  (void)data;
+  (void)length;
+  (void)seed;
+  return 7;
+}
+
+void TestHash_mapped() {
+  HashOptions options = {.seed = {42, 0}};
+  Hash *source = Hash_newWith(&options);
+  char key[32];
+  for (int i = 0; i < MAPPED_KEYS; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    assert(Hash_set(source, key, &i, sizeof(i)));
+  }
+  // Binary keys and empty values are saved too
+  assert(Hash_setn(source, "a\0b", 3, "", 0));
+  assert(Hash_save(source, MAPPED_FILE));
+  // The temporary file is renamed
+  FILE *temporary = fopen(MAPPED_FILE ".tmp", "rb");
+  assert(temporary == NULL);
+  printf(".");
+
+  Hash *mapped = Hash_openMapped(MAPPED_FILE);
+  assert(mapped != NULL);
+  assert(Hash_length(mapped) == MAPPED_KEYS + 1);
+  for (int i = 0; i < MAPPED_KEYS; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    int *value = (int *)Hash_getValue(mapped, key);
+    assert(value != NULL && *value == i);
+  }
+  assert(Hash_getValue(mapped, "key -1") == NULL);
+  Tuple *item = Hash_getn(mapped, "a\0b", 3);
+  assert(item != NULL && item->keyLength == 3 && item->length == 0);
+  Tuple_free(&item);
+  Tuple found;
+  assert(Hash_getInto(mapped, "key 7", &found));
+  assert(strcmp(found.key, "key 7") == 0 && found.length == sizeof(int));
+  // The batch lookup has no Tuples to return
+  const char *batchKeys[] = {"key 1", "key 2"};
+  const Tuple *batchItems[] = {&found, &found};
+  assert(Hash_getMany(mapped, batchKeys, 2, batchItems) == 0);
+  assert(batchItems[0] == NULL && batchItems[1] == NULL);
+  printf(".");
+
+  // Mapped hashes are read-only
+  int value = 1;
+  assert(!Hash_set(mapped, "key 7", &value, sizeof(value)));
+  assert(!Hash_set(mapped, "new", &value, sizeof(value)));
+  assert(!Hash_delete(mapped, "key 7"));
+  assert(Hash_length(mapped) == MAPPED_KEYS + 1);
+  printf(".");
+
+  // The iterator visits all the items, and a mapped hash can be saved again
+  HashIter iter;
+  HashIter_init(&iter, mapped);
+  int count = 0;
+  const Tuple *next;
+  while ((next = HashIter_next(&iter)) != NULL) {
+    assert(Hash_getRefn(source, next->key, next->keyLength) != NULL);
+    count++;
+  }
+  assert(count == MAPPED_KEYS + 1);
+  assert(Hash_save(mapped, MAPPED_FILE ".copy"));
+  Hash *copy = Hash_openMapped(MAPPED_FILE ".copy");
+  assert(copy != NULL && Hash_length(copy) == MAPPED_KEYS + 1);
+  assert(*(int *)Hash_getValue(copy, "key 4999") == 4999);
+  Hash_free(&copy);
+  printf(".");
+
+  // Hashes with custom functions can't be saved, broken files can't be opened
+  HashOptions custom = {.function = TestHash_constant};
+  Hash *other = Hash_newWith(&custom);
+  assert(!Hash_save(other, MAPPED_FILE ".copy"));
+  Hash_free(&other);
+  FILE *file = fopen(MAPPED_FILE ".copy", "wb");
+  assert(file != NULL);
+  fputs("not a snapshot", file);
+  fclose(file);
+  assert(Hash_openMapped(MAPPED_FILE ".copy") == NULL);
+  assert(Hash_openMapped("bin/does-not-exist") == NULL);
+  printf(".");
+
+  // A broken bucket index is only read by the lookups, which skip its buckets
+  FILE *input = fopen(MAPPED_FILE, "rb");
+  file = fopen(MAPPED_FILE ".copy", "wb");
+  assert(input != NULL && file != NULL);
+  int byte;
+  for (long offset = 0; (byte = fgetc(input)) != EOF; offset++) {
+    // The first 64 bucket starts follow the 64 bytes of the header
+    fputc((offset >= 64 && offset < 64 + 64 * 8) ? 0xff : byte, file);
+  }
+  fclose(input);
+  fclose(file);
+  copy = Hash_openMapped(MAPPED_FILE ".copy");
+  assert(copy != NULL);
+  int foundKeys = 0;
+  for (int i = 0; i < MAPPED_KEYS; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    int *stored = (int *)Hash_getValue(copy, key);
+    if (stored != NULL) {
+      assert(*stored == i);
+      foundKeys++;
+    }
+  }
+  assert(foundKeys > 0 && foundKeys < MAPPED_KEYS);
+  Hash_free(&copy);
+  printf(".");
+
+  Hash_free(&mapped);
+  assert(mapped == NULL);
+  Hash_free(&source);
+  remove(MAPPED_FILE);
+  remove(MAPPED_FILE ".copy");
+  printf(".");
+}
+
+void TestHash_loadFile() {
+  const char *path = "tests/utf8_1000x16xucs4.txt";
+  HashOptions options = {.backend = HASH_OPEN};
+  Hash *lines = Hash_newWith(&options);
+  assert(Hash_loadFile(lines, path, HASH_LINES));
+  assert(Hash_length(lines) == 1000);
+  printf(".");
+
+  // Each line is a key, its value is the line number
+  FILE *source = fopen(path, "r");
+  assert(source != NULL);
+  char buffer[1024];
+  int number = 0;
+  while (fgets(buffer, sizeof(buffer), source) != NULL) {
+    number++;
+    buffer[strcspn(buffer, "\n")] = '\0';
+    // The byte order mark is not part of the first key
+    const char *key = (number == 1) ? buffer + 3 : buffer;
+    int *value = (int *)Hash_getValue(lines, key);
+    assert(value != NULL && *value == number);
+  }
+  fclose(source);
+  assert(number == 1000);
+  Hash_free(&lines);
+  printf(".");
+
+  // TSV values are strings, CRLF and empty lines are handled
+  const char *tsvPath = "bin/load_test.tsv";
+  FILE *tsv = fopen(tsvPath, "wb");
+  assert(tsv != NULL);
+  fputs("\xEF\xBB\xBF" "apple\tred\r\n\nbanana\tyellow\tripe\nkiwi\napple\tgreen", tsv);
+  fclose(tsv);
+  Hash *fruits = Hash_new();
+  assert(Hash_set(fruits, "plum", "purple", 7));
+  assert(Hash_loadFile(fruits, tsvPath, HASH_TSV));
+  assert(Hash_length(fruits) == 4);
+  assert(strcmp(Hash_getValue(fruits, "apple"), "green") == 0);
+  assert(strcmp(Hash_getValue(fruits, "banana"), "yellow\tripe") == 0);
+  assert(strcmp(Hash_getValue(fruits, "kiwi"), "") == 0);
+  assert(strcmp(Hash_getValue(fruits, "plum"), "purple") == 0);
+  printf(".");
+
+  // Missing files are reported, empty files add nothing
+  assert(!Hash_loadFile(fruits, "bin/does-not-exist", HASH_LINES));
+  tsv = fopen(tsvPath, "wb");
+  fclose(tsv);
+  assert(Hash_loadFile(fruits, tsvPath, HASH_TSV));
+  assert(Hash_length(fruits) == 4);
+  assert(Hash_reserve(fruits, 10000));
+  assert(strcmp(Hash_getValue(fruits, "kiwi"), "") == 0);
+  Hash_free(&fruits);
+  remove(tsvPath);
+  printf(".");
+}
+
+typedef struct {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+  size_t position;
+} TestStream;
+
+static bool TestStream_write(const void *data, size_t size, void *context) {
+  TestStream *stream = (TestStream *)context;
+  if (stream->size + size > stream->capacity) {
+    size_t capacity = (stream->capacity > 0) ? stream->capacity * 2 : 4096;
+    while (capacity < stream->size + size) capacity *= 2;
+    unsigned char *bigger = (unsigned char *)realloc(stream->data, capacity);
+    if (bigger == NULL) return false;
+    stream->data = bigger;
+    stream->capacity = capacity;
+  }
+  memcpy(stream->data + stream->size, data, size);
+  stream->size += size;
+  return true;
+}
+
+static bool TestStream_read(void *data, size_t size, void *context) {
+  TestStream *stream = (TestStream *)context;
+  if (stream->size - stream->position < size) return false;
+  memcpy(data, stream->data + stream->position, size);
+  stream->position += size;
+  return true;
+}
+
+#define STREAM_KEYS 60000
+
+void TestHash_serialize() {
+  Hash *source = Hash_new();
+  char key[32];
+  char value[40];
+  for (int i = 0; i < STREAM_KEYS; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    snprintf(value, sizeof(value), "value %d with some padding", i);
+    assert(Hash_set(source, key, value, strlen(value) + 1));
+  }
+  // A value bigger than a chunk gets a chunk of its own
+  size_t bigSize = 3 << 20;
+  char *big = (char *)calloc(bigSize, 1);
+  assert(big != NULL);
+  big[bigSize - 1] = 'z';
+  assert(Hash_set(source, "big", big, bigSize));
+  assert(Hash_setn(source, "a\0b", 3, "", 0));
+  TestStream stream = {0};
+  assert(Hash_serialize(source, TestStream_write, &stream));
+  printf(".");
+
+  // The items are parsed on several threads, existing keys are updated
+  HashOptions options = {.backend = HASH_OPEN};
+  Hash *copy = Hash_newWith(&options);
+  assert(Hash_set(copy, "key 1", "old", 4));
+  assert(Hash_set(copy, "other", "kept", 5));
+  assert(Hash_deserialize(copy, TestStream_read, &stream, 4));
+  assert(stream.position == stream.size);
+  assert(Hash_length(copy) == STREAM_KEYS + 3);
+  for (int i = 0; i < STREAM_KEYS; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    snprintf(value, sizeof(value), "value %d with some padding", i);
+    const char *found = Hash_getValue(copy, key);
+    assert(found != NULL && strcmp(found, value) == 0);
+  }
+  const Tuple *item = Hash_getRef(copy, "big");
+  assert(item != NULL && item->length == bigSize && memcmp(item->value, big, bigSize) == 0);
+  item = Hash_getRefn(copy, "a\0b", 3);
+  assert(item != NULL && item->length == 0);
+  assert(strcmp(Hash_getValue(copy, "other"), "kept") == 0);
+  Hash_free(&copy);
+  printf(".");
+
+  // A single thread gives the same result
+  stream.position = 0;
+  copy = Hash_new();
+  assert(Hash_deserialize(copy, TestStream_read, &stream, 1));
+  assert(Hash_length(copy) == STREAM_KEYS + 2);
+  assert(strcmp(Hash_getValue(copy, "key 59999"), "value 59999 with some padding") == 0);
+  Hash_free(&copy);
+  printf(".");
+
+  // Truncated and corrupted streams are rejected
+  stream.position = 0;
+  stream.size -= 20;
+  copy = Hash_new();
+  assert(!Hash_deserialize(copy, TestStream_read, &stream, 2));
+  stream.position = 0;
+  stream.size += 20;
+  stream.data[0] = 'x';
+  assert(!Hash_deserialize(copy, TestStream_read, &stream, 2));
+  Hash_free(&copy);
+  printf(".");
+
+  free(stream.data);
+  free(big);
+  Hash_free(&source);
+  printf(".");
+}
+
+#define PARALLEL_KEYS 100000
+
+void TestHash_parallel() {
+  // Every key appears twice, the second value wins
+  size_t count = PARALLEL_KEYS * 2;
+  char **keys = (char **)malloc(count * sizeof(char *));
+  const void **values = (const void **)malloc(count * sizeof(void *));
+  size_t *lengths = (size_t *)malloc(count * sizeof(size_t));
+  int *numbers = (int *)malloc(count * sizeof(int));
+  assert(keys != NULL && values != NULL && lengths != NULL && numbers != NULL);
+  for (size_t i = 0; i < count; i++) {
+    keys[i] = (char *)malloc(16);
+    assert(keys[i] != NULL);
+    snprintf(keys[i], 16, "key %zu", i % PARALLEL_KEYS);
+    numbers[i] = (int)i;
+    values[i] = &numbers[i];
+    lengths[i] = sizeof(int);
+  }
+  HashOptions options = {.threads = 4, .fastFree = true};
+  Hash *myhash = Hash_buildParallel(&options, (const char *const *)keys, values, lengths, count, 8);
+  assert(myhash != NULL);
+  assert(Hash_length(myhash) == PARALLEL_KEYS);
+  for (size_t i = 0; i < PARALLEL_KEYS; i++) {
+    int *value = (int *)Hash_getValue(myhash, keys[i]);
+    assert(value != NULL && *value == (int)(i + PARALLEL_KEYS));
+  }
+  printf(".");
+
+  // The built hash works as usual, and is freed on 4 threads
+  assert(Hash_delete(myhash, "key 0"));
+  assert(Hash_set(myhash, "new", "value", 6));
+  assert(Hash_length(myhash) == PARALLEL_KEYS);
+  HashIter iter;
+  HashIter_init(&iter, myhash);
+  int visited = 0;
+  while (HashIter_next(&iter) != NULL) visited++;
+  assert(visited == PARALLEL_KEYS);
+  Hash_free(&myhash);
+  assert(myhash == NULL);
+  printf(".");
+
+  // Open addressing hashes are built by a single thread, and freed on many
+  options = (HashOptions){.backend = HASH_OPEN, .threads = 3};
+  myhash = Hash_buildParallel(&options, (const char *const *)keys, values, lengths, count, 8);
+  assert(myhash != NULL && Hash_length(myhash) == PARALLEL_KEYS);
+  assert(*(int *)Hash_getValue(myhash, "key 5") == PARALLEL_KEYS + 5);
+  Hash_free(&myhash);
+  printf(".");
+
+  // Small inputs don't need threads
+  myhash = Hash_buildParallel(NULL, (const char *const *)keys, values, lengths, 10, 8);
+  assert(myhash != NULL && Hash_length(myhash) == 10);
+  Hash_free(&myhash);
+  printf(".");
+
+  for (size_t i = 0; i < count; i++) free(keys[i]);
+  free(keys);
+  free(values);
+  free(lengths);
+  free(numbers);
+  printf(".");
+}
+
+void TestHash_stats() {
+  HashOptions options = {.capacity = 16, .stats = true};
+  Hash *myhash = Hash_newWith(&options);
+  assert(myhash != NULL);
+  HashStats stats;
+  Hash_stats(myhash, &stats);
+  assert(stats.items == 0 && stats.buckets == 16 && stats.loadFactor == 0);
+  assert(stats.chains[0] == 16 && stats.maxProbe == 0);
+  assert(stats.nodeBytes == 0 && stats.tableBytes >= 16 * sizeof(void *));
+  assert(stats.lookups == 0 && stats.comparisons == 0);
+  printf(".");
+
+  // The histogram accounts for all the buckets and all the items
+  char key[16];
+  for (int i = 0; i < 8; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    assert(Hash_set(myhash, key, &i, sizeof(i)));
+  }
+  Hash_stats(myhash, &stats);
+  assert(stats.items == 8 && stats.loadFactor == 0.5);
+  size_t buckets = 0, items = 0;
+  for (size_t n = 0; n < HASH_STATS_CHAINS; n++) {
+    buckets += stats.chains[n];
+    items += n * stats.chains[n];
+  }
+  assert(buckets == 16 && items == 8);
+  assert(stats.maxProbe >= 1 && stats.nodeBytes > 0);
+  printf(".");
+
+  // Each setter looks up its key first
+  for (int i = 0; i < 8; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    assert(*(int *)Hash_getValue(myhash, key) == i);
+  }
+  assert(Hash_getValue(myhash, "missing") == NULL);
+  Hash_stats(myhash, &stats);
+  if (stats.counting) {
+    assert(stats.lookups == 17 && stats.hits == 8 && stats.misses == 9);
+    assert(stats.comparisons >= 8 && stats.comparisonsPerLookup > 0);
+  } else {
+    assert(stats.lookups == 0);
+  }
+  Hash_free(&myhash);
+  printf(".");
+
+  // A bad hash function puts all the keys in one bucket
+  options = (HashOptions){.function = TestHash_constant, .stats = true};
+  myhash = Hash_newWith(&options);
+  assert(myhash != NULL);
+  for (int i = 0; i < 10; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    assert(Hash_set(myhash, key, &i, sizeof(i)));
+  }
+  assert(Hash_getValue(myhash, "key 0") != NULL);
+  Hash_stats(myhash, &stats);
+  assert(stats.maxProbe == 10 && stats.chains[HASH_STATS_CHAINS - 1] == 1);
+  assert(stats.chains[0] == stats.buckets - 1);
+  if (stats.counting) assert(stats.comparisonsPerLookup > 1);
+  Hash_free(&myhash);
+  printf(".");
+
+  // Open addressing hashes count the groups probed for each item,
+  // and hashes without the stats option don't count the lookups
+  options = (HashOptions){.backend = HASH_OPEN};
+  myhash = Hash_newWith(&options);
+  assert(myhash != NULL);
+  for (int i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "key %d", i);
+    assert(Hash_set(myhash, key, &i, sizeof(i)));
+  }
+  Hash_stats(myhash, &stats);
+  assert(stats.items == 1000 && stats.buckets >= 1000 && stats.chains[0] == 0);
+  items = 0;
+  for (size_t n = 0; n < HASH_STATS_CHAINS; n++) items += stats.chains[n];
+  assert(items == 1000 && stats.maxProbe >= 1);
+  assert(!stats.counting && stats.lookups == 0);
+  Hash_free(&myhash);
+  printf(".");
+}
+
+/**
+ * Allocator that counts the live allocations, and fails
+ * when the limit is reached
+ */
+typedef struct {
+  size_t live;
+  size_t allocations;
+  size_t limit;
+} TestPool;
+
+static void *TestPool_alloc(size_t size, void *context) {
+  TestPool *pool = (TestPool *)context;
+  assert(size > 0);
+  if (pool->limit > 0 && pool->allocations >= pool->limit) return NULL;
+  pool->live++;
+  pool->allocations++;
+  return malloc(size);
+}
+
+static void *TestPool_realloc(void *pointer, size_t size, void *context) {
+  TestPool *pool = (TestPool *)context;
+  assert(pointer != NULL && size > 0);
+  if (pool->limit > 0 && pool->allocations >= pool->limit) return NULL;
+  pool->allocations++;
+  return realloc(pointer, size);
+}
+
+static void TestPool_free(void *pointer, void *context) {
+  TestPool *pool = (TestPool *)context;
+  assert(pointer != NULL && pool->live > 0);
+  pool->live--;
+  free(pointer);
+}
+
+void TestHash_allocator() {
+  TestPool pool = {0};
+  HashAllocator allocator = {TestPool_alloc, TestPool_realloc, TestPool_free, &pool};
+  HashOptions variants[] = {
+    {.allocator = &allocator},
+    {.allocator = &allocator, .fastFree = true},
+    {.allocator = &allocator, .backend = HASH_OPEN},
+    {.allocator = &allocator, .arena = true},
+    {.allocator = &allocator, .ordered = true, .sorted = true, .stats = true}
+  };
+  char key[64];
+  for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+    Hash *myhash = Hash_newWith(&variants[v]);
+    assert(myhash != NULL && pool.live > 0);
+    // Enough items to resize the table, with long keys and values
+    for (int i = 0; i < 1000; i++) {
+      snprintf(key, sizeof(key), "a key long enough not to fit inline %d", i);
+      assert(Hash_set(myhash, key, key, strlen(key) + 1));
+    }
+    // Bigger values, then smaller ones
+    for (int i = 0; i < 1000; i += 2) {
+      snprintf(key, sizeof(key), "a key long enough not to fit inline %d", i);
+      assert(Hash_set(myhash, key, key, sizeof(key)));
+      assert(Hash_set(myhash, key, &i, sizeof(i)));
+    }
+    for (int i = 0; i < 1000; i += 3) {
+      snprintf(key, sizeof(key), "a key long enough not to fit inline %d", i);
+      assert(Hash_delete(myhash, key));
+    }
+    assert(Hash_length(myhash) == 666);
+    Hash_free(&myhash);
+    assert(pool.live == 0);
+    printf(".");
+  }
+
+  // The other tables take their memory from the allocator too
+  IntHash *ints = IntHash_new(sizeof(key), &variants[0]);
+  RcuHash *rcu = RcuHash_new(&variants[0]);
+  ConcurrentHash *concurrent = ConcurrentHash_new(&variants[0], 4);
+  assert(ints != NULL && rcu != NULL && concurrent != NULL);
+  for (int i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "a key long enough not to fit inline %d", i);
+    assert(IntHash_set(ints, (uint64_t)i, key));
+    assert(RcuHash_set(rcu, key, key, strlen(key) + 1));
+    assert(RcuHash_set(rcu, key, &i, sizeof(i)));
+    assert(ConcurrentHash_set(concurrent, key, key, strlen(key) + 1));
+  }
+  IntHash_free(&ints);
+  RcuHash_free(&rcu);
+  ConcurrentHash_free(&concurrent);
+  assert(pool.live == 0);
+  printf(".");
+
+  // The allocations that fail are reported, and nothing leaks
+  pool = (TestPool){.limit = 50};
+  Hash *myhash = Hash_newWith(&variants[0]);
+  assert(myhash != NULL);
+  int stored = 0;
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "a key long enough not to fit inline %d", i);
+    if (Hash_set(myhash, key, key, strlen(key) + 1)) stored++;
+  }
+  assert(stored > 0 && stored < 100 && Hash_length(myhash) == stored);
+  Hash_free(&myhash);
+  assert(pool.live == 0);
+  printf(".");
+
+  // All the functions are needed
+  allocator.free = NULL;
+  assert(Hash_newWith(&variants[0]) == NULL);
+  printf(".");
+}
+
+typedef struct {double x; double y;} Point;
+VHASH_DECLARE(PointMap, uint64_t, Point, VHash_intHash, VHash_intEqual)
+VHASH_DECLARE(WordCount, const char *, int, VHash_stringHash, VHash_stringEqual)
+
+void TestHash_typed() {
+  PointMap *points = PointMap_new(0);
+  assert(points != NULL);
+  assert(PointMap_length(points) == 0);
+  assert(PointMap_get(points, 1) == NULL);
+  printf(".");
+
+  // Values are stored in the table and updated in place
+  for (uint64_t i = 0; i < 1000; i++) {
+    assert(PointMap_set(points, i, (Point){(double)i, (double)i * 2}));
+  }
+  assert(PointMap_length(points) == 1000);
+  Point *point = PointMap_get(points, 500);
+  assert(point != NULL && point->x == 500 && point->y == 1000);
+  point->y = -1;
+  assert(PointMap_get(points, 500)->y == -1);
+  assert(PointMap_set(points, 500, (Point){0, 0}));
+  assert(PointMap_length(points) == 1000);
+  printf(".");
+
+  // Deleted keys are gone, the others are still reachable
+  for (uint64_t i = 0; i < 1000; i += 3) {
+    assert(PointMap_delete(points, i));
+  }
+  assert(!PointMap_delete(points, 0));
+  size_t count = 0;
+  for (uint64_t i = 0; i < 1000; i++) {
+    assert(PointMap_has(points, i) == (i % 3 != 0));
+    if (i % 3 != 0) count++;
+  }
+  assert(PointMap_length(points) == count);
+  size_t position = 0;
+  uint64_t key;
+  while (PointMap_next(points, &position, &key, &point)) count--;
+  assert(count == 0);
+  PointMap_free(&points);
+  assert(points == NULL);
+  printf(".");
+
+  // String keys are compared by content and not copied
+  WordCount *words = WordCount_new(16);
+  const char *text[] = {"the", "cat", "and", "the", "hat", "the", "cat"};
+  for (size_t i = 0; i < sizeof(text) / sizeof(text[0]); i++) {
+    int *found = WordCount_get(words, text[i]);
+    if (found != NULL) {
+      (*found)++;
+    } else {
+      assert(WordCount_set(words, text[i], 1));
+    }
+  }
+  char buffer[] = "the";
+  assert(WordCount_length(words) == 4);
+  assert(*WordCount_get(words, buffer) == 3);
+  assert(*WordCount_get(words, "cat") == 2);
+  assert(WordCount_get(words, "dog") == NULL);
+  WordCount_free(&words);
+  printf(".");
+}
+
 void TestHash_unicode() {
   Hash *myhash = Hash_new();
   char *key = NULL;
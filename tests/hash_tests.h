@@ -36,6 +36,75 @@
   void TestHash_first();
   void TestHash_last();
 
+  // Tests growing and shrinking
+  void TestHash_resize();
+
+  // Tests the hash functions and their use within a Hash
+  void TestHash_functions();
+
+  // Tests the open addressing backend
+  void TestHash_open();
+
+  // Tests the arena allocator
+  void TestHash_arena();
+
+  // Tests lookups without allocations
+  void TestHash_ref();
+
+  // Tests freeing without wiping
+  void TestHash_fastFree();
+
+  // Tests in-place updates
+  void TestHash_update();
+
+  // Tests borrowed and owned values
+  void TestHash_setRef();
+
+  // Tests the thread-safe hash
+  void TestHash_concurrent();
+
+  // Tests lock-free reads
+  void TestHash_rcu();
+
+  // Tests batched lookups
+  void TestHash_getMany();
+
+  // Tests iterators and insertion order
+  void TestHash_iter();
+
+  // Tests the sorted index
+  void TestHash_sorted();
+
+  // Tests keys with NULL bytes
+  void TestHash_binary();
+
+  // Tests integer keys
+  void TestHash_int();
+
+  // Tests small values stored inside the items
+  void TestHash_inline();
+
+  // Tests the compile-time typed hashes
+  void TestHash_typed();
+
+  // Tests saving and mapping snapshots
+  void TestHash_mapped();
+
+  // Tests loading text files
+  void TestHash_loadFile();
+
+  // Tests streaming a hash
+  void TestHash_serialize();
+
+  // Tests building and freeing hashes on many threads
+  void TestHash_parallel();
+
+  // Tests the statistics of a hash
+  void TestHash_stats();
+
+  // Tests hashes with a custom allocator
+  void TestHash_allocator();
+
   void TestHash_unicode();
   void TestHash_bulk();
 #endif
@@ -55,6 +55,29 @@ int main() {
   TestHash_first();
   TestHash_last();
   TestHash_delete();
+  TestHash_resize();
+  TestHash_functions();
+  TestHash_open();
+  TestHash_arena();
+  TestHash_ref();
+  TestHash_fastFree();
+  TestHash_update();
+  TestHash_setRef();
+  TestHash_concurrent();
+  TestHash_rcu();
+  TestHash_getMany();
+  TestHash_iter();
+  TestHash_sorted();
+  TestHash_binary();
+  TestHash_int();
+  TestHash_inline();
+  TestHash_typed();
+  TestHash_mapped();
+  TestHash_loadFile();
+  TestHash_serialize();
+  TestHash_parallel();
+  TestHash_stats();
+  TestHash_allocator();
 
   printf("\n");
   printf("\n");